@@ -0,0 +1,409 @@
+// engine for grids of any box order, included by main.c once per size with GRID_BOX defined
+// GRID_BOX 3 is the usual 9x9 grid, 4 is 16x16 (hexadoku) and 5 is 25x25
+//
+// every size gets its own copy of the code, with names suffixed by the side length
+// (grid_16, solve_grid_16, ...), the narrowest mask that holds one bit per value and the
+// narrowest integer that holds a cell index, so the compiler sees constant bounds everywhere
+//
+// the search is the one of the propagating bitmask engine: lone and hidden singles after
+// every guess, branch on the cell with the fewest candidates, each guess on a copy of the state
+
+#if !defined(GRID_BOX)
+#error "define GRID_BOX before including grid_n.h"
+#endif
+
+#define GRID_N (GRID_BOX * GRID_BOX)
+#define GRID_CELLS (GRID_N * GRID_N)
+#define GRID_ALL ((GRID_MASK) (((u64) 1 << GRID_N) - 1))
+
+// GRID_N is an expression, the suffix has to be a plain number to be pasted onto names
+#if GRID_BOX == 3
+#define GRID_SUFFIX 9
+#elif GRID_BOX == 4
+#define GRID_SUFFIX 16
+#elif GRID_BOX == 5
+#define GRID_SUFFIX 25
+#else
+#error "GRID_BOX must be 3, 4 or 5"
+#endif
+
+#define GN_CONCAT_(name, n) name##_##n
+#define GN_CONCAT(name, n) GN_CONCAT_(name, n)
+#define GN(name) GN_CONCAT(name, GRID_SUFFIX)
+
+#if GRID_N <= 16
+#define GRID_MASK u16
+#define GRID_POPCOUNT popcount16
+#else
+#define GRID_MASK u32
+#define GRID_POPCOUNT popcount32
+#endif
+
+#if GRID_CELLS <= 256
+#define GRID_CELL u8
+#else
+#define GRID_CELL u16
+#endif
+
+struct GN(grid) {
+    // row-major, 0 is an empty cell
+    u8 values[GRID_CELLS];
+};
+
+struct GN(grid_state) {
+    u8 values[GRID_CELLS];
+    
+    // bit i set => value i + 1 is placed in that row/col/box
+    GRID_MASK row_used[GRID_N];
+    GRID_MASK col_used[GRID_N];
+    GRID_MASK box_used[GRID_N];
+};
+
+// filled in once by GN(grid_init_tables)
+u8 GN(grid_cell_row)[GRID_CELLS];
+u8 GN(grid_cell_col)[GRID_CELLS];
+u8 GN(grid_cell_box)[GRID_CELLS];
+
+// rows, then columns, then boxes
+GRID_CELL GN(grid_unit_cells)[3 * GRID_N][GRID_N];
+
+once_flag GN(grid_tables_once) = ONCE_FLAG_INIT;
+
+void GN(grid_init_tables)(void) {
+    for (u32 cell_idx = 0; cell_idx < GRID_CELLS; cell_idx++) {
+        u32 row = cell_idx / GRID_N;
+        u32 col = cell_idx % GRID_N;
+        u32 box = row / GRID_BOX * GRID_BOX + col / GRID_BOX;
+        u32 in_box = row % GRID_BOX * GRID_BOX + col % GRID_BOX;
+        
+        GN(grid_cell_row)[cell_idx] = (u8) row;
+        GN(grid_cell_col)[cell_idx] = (u8) col;
+        GN(grid_cell_box)[cell_idx] = (u8) box;
+        
+        GN(grid_unit_cells)[row][col] = (GRID_CELL) cell_idx;
+        GN(grid_unit_cells)[GRID_N + col][row] = (GRID_CELL) cell_idx;
+        GN(grid_unit_cells)[2 * GRID_N + box][in_box] = (GRID_CELL) cell_idx;
+    }
+}
+
+// parses GRID_CELLS characters, '.' or '0' is an empty cell and values are 1-9 then A, B, ...
+// (either case), returns the index of the first bad character or GRID_CELLS if there is none
+u32 GN(parse_grid)(const char *cells, struct GN(grid) *into) {
+    for (u32 cell_idx = 0; cell_idx < GRID_CELLS; cell_idx++) {
+        char ch = cells[cell_idx];
+        u32 value;
+        
+        if (ch == '.' || ch == '0')
+            value = 0;
+        else if (ch >= '1' && ch <= '9')
+            value = ch - '0';
+        else if (ch >= 'A' && ch <= 'Z')
+            value = ch - 'A' + 10;
+        else if (ch >= 'a' && ch <= 'z')
+            value = ch - 'a' + 10;
+        else
+            return cell_idx;
+        
+        if (value > GRID_N)
+            return cell_idx;
+        
+        into->values[cell_idx] = (u8) value;
+    }
+    
+    return GRID_CELLS;
+}
+
+// returns whether every row, col and box holds every value once
+bool GN(grid_is_solved)(const struct GN(grid) *grid) {
+    call_once(&GN(grid_tables_once), GN(grid_init_tables));
+    
+    for (u32 unit_idx = 0; unit_idx < 3 * GRID_N; unit_idx++) {
+        GRID_MASK seen = 0;
+        
+        for (u32 i = 0; i < GRID_N; i++) {
+            u32 value = grid->values[GN(grid_unit_cells)[unit_idx][i]];
+            if (value == 0)
+                return false;
+            seen |= (GRID_MASK) 1 << (value - 1);
+        }
+        
+        if (seen != GRID_ALL)
+            return false;
+    }
+    
+    return true;
+}
+
+static inline GRID_MASK GN(grid_cell_candidates)(const struct GN(grid_state) *state, u32 cell_idx) {
+    GRID_MASK used = state->row_used[GN(grid_cell_row)[cell_idx]] | state->col_used[GN(grid_cell_col)[cell_idx]] | state->box_used[GN(grid_cell_box)[cell_idx]];
+    return ~used & GRID_ALL;
+}
+
+static inline void GN(grid_set_value)(struct GN(grid_state) *state, u32 cell_idx, u32 value) {
+    GRID_MASK bit = (GRID_MASK) 1 << (value - 1);
+    
+    state->values[cell_idx] = (u8) value;
+    state->row_used[GN(grid_cell_row)[cell_idx]] |= bit;
+    state->col_used[GN(grid_cell_col)[cell_idx]] |= bit;
+    state->box_used[GN(grid_cell_box)[cell_idx]] |= bit;
+}
+
+// places lone and hidden singles until there are none left, returns false on a contradiction
+bool GN(grid_propagate)(struct GN(grid_state) *state) {
+    bool revealed_at_least_one;
+    
+    do {
+        revealed_at_least_one = false;
+        
+        for (u32 cell_idx = 0; cell_idx < GRID_CELLS; cell_idx++) {
+            if (state->values[cell_idx] != 0)
+                continue;
+            
+            GRID_MASK candidates = GN(grid_cell_candidates)(state, cell_idx);
+            if (candidates == 0)
+                return false;
+            
+            if (candidates & (candidates - 1))
+                continue;
+            
+            GN(grid_set_value)(state, cell_idx, ctz32(candidates) + 1);
+            STAT_ADD(lone_singles, 1);
+            revealed_at_least_one = true;
+        }
+        
+        for (u32 unit_idx = 0; unit_idx < 3 * GRID_N; unit_idx++) {
+            const GRID_CELL *cells = GN(grid_unit_cells)[unit_idx];
+            
+            GRID_MASK placed = 0;
+            GRID_MASK seen_once = 0;
+            GRID_MASK seen_twice = 0;
+            for (u32 i = 0; i < GRID_N; i++) {
+                u32 value = state->values[cells[i]];
+                if (value != 0) {
+                    placed |= (GRID_MASK) 1 << (value - 1);
+                    continue;
+                }
+                
+                GRID_MASK candidates = GN(grid_cell_candidates)(state, cells[i]);
+                seen_twice |= seen_once & candidates;
+                seen_once |= candidates;
+            }
+            
+            if ((placed | seen_once) != GRID_ALL)
+                return false;
+            
+            GRID_MASK hidden_singles = seen_once & ~seen_twice;
+            
+            while (hidden_singles) {
+                u32 value_idx = ctz32(hidden_singles);
+                hidden_singles &= hidden_singles - 1;
+                
+                u32 i;
+                for (i = 0; i < GRID_N; i++) {
+                    u32 cell_idx = cells[i];
+                    if (state->values[cell_idx] == 0 && (GN(grid_cell_candidates)(state, cell_idx) & ((GRID_MASK) 1 << value_idx))) {
+                        GN(grid_set_value)(state, cell_idx, value_idx + 1);
+                        STAT_ADD(hidden_singles, 1);
+                        revealed_at_least_one = true;
+                        break;
+                    }
+                }
+                
+                // the only cell for this value was taken by another hidden single
+                if (i == GRID_N)
+                    return false;
+            }
+        }
+    } while (revealed_at_least_one);
+    
+    return true;
+}
+
+// solutions found so far by GN(grid_search)
+struct GN(grid_counter) {
+    // stop once this many are found, 0 means find them all
+    u64 cap;
+    u64 n_solutions;
+    struct GN(grid) first_solution;
+};
+
+// returns true if it stopped because the cap was reached
+bool GN(grid_search)(struct GN(grid_state) *state, struct GN(grid_counter) *counter, struct sudoku_solve_stats *stats) {
+    if (!GN(grid_propagate)(state))
+        return false;
+    
+    // branch on the empty cell with the fewest candidates
+    u32 best_cell = GRID_CELLS;
+    u32 best_count = GRID_N + 1;
+    for (u32 cell_idx = 0; cell_idx < GRID_CELLS; cell_idx++) {
+        if (state->values[cell_idx] != 0)
+            continue;
+        
+        u32 count = GRID_POPCOUNT(GN(grid_cell_candidates)(state, cell_idx));
+        if (count < best_count) {
+            best_count = count;
+            best_cell = cell_idx;
+            
+            // propagation already placed every single, nothing will beat a pair
+            if (count <= 2)
+                break;
+        }
+    }
+    
+    if (best_cell == GRID_CELLS) {
+        if (counter->n_solutions == 0)
+            memcpy(counter->first_solution.values, state->values, sizeof(state->values));
+        counter->n_solutions++;
+        return counter->cap != 0 && counter->n_solutions >= counter->cap;
+    }
+    
+    GRID_MASK candidates = GN(grid_cell_candidates)(state, best_cell);
+    
+    while (candidates) {
+        u32 value = ctz32(candidates) + 1;
+        candidates &= candidates - 1;
+        
+        struct GN(grid_state) guess = *state;
+        GN(grid_set_value)(&guess, best_cell, value);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (GN(grid_search)(&guess, counter, stats))
+            return true;
+        
+        STAT_BACKTRACK();
+    }
+    
+    return false;
+}
+
+// solves initial_state into into, returns the number of solutions found like solve_with_options,
+// only count_solutions and solution_cap of options are used
+u64 GN(solve_grid)(const struct sudoku_solve_options *options, const struct GN(grid) *initial_state, struct GN(grid) *into, struct sudoku_solve_stats *stats) {
+    assert(options);
+    assert(initial_state);
+    assert(stats);
+    
+    call_once(&GN(grid_tables_once), GN(grid_init_tables));
+
+#if defined(SUDOKU_STATS)
+    active_stats = stats;
+    stats->depth = 0;
+#endif
+    
+    STAT_PHASE_START(setup_start);
+    
+    *into = *initial_state;
+    
+    struct GN(grid_state) state;
+    memset(&state, 0, sizeof(state));
+    
+    for (u32 cell_idx = 0; cell_idx < GRID_CELLS; cell_idx++) {
+        u32 value = initial_state->values[cell_idx];
+        if (value == 0)
+            continue;
+        
+        // conflicting givens
+        if (!(GN(grid_cell_candidates)(&state, cell_idx) & ((GRID_MASK) 1 << (value - 1))))
+            return 0;
+        
+        GN(grid_set_value)(&state, cell_idx, value);
+    }
+    
+    STAT_PHASE_END(setup_seconds, setup_start);
+    STAT_PHASE_START(search_start);
+    
+    struct GN(grid_counter) counter;
+    counter.cap = options->count_solutions ? options->solution_cap : 1;
+    counter.n_solutions = 0;
+    
+    GN(grid_search)(&state, &counter, stats);
+    
+    STAT_PHASE_END(search_seconds, search_start);
+    
+    if (counter.n_solutions > 0)
+        *into = counter.first_solution;
+    
+    return counter.n_solutions;
+}
+
+// solves the puzzles of a file with one puzzle of GRID_CELLS characters per line ("-" is stdin)
+// one at a time, reports the ones that have no solution and exits on a wrong solution
+// returns the number of puzzles, solve_duration is set to the time spent solving them
+u64 GN(solve_grid_file)(const struct sudoku_solve_options *options, const char *file_name, struct sudoku_solve_stats *stats, double *solve_duration) {
+    struct sdm_reader *reader = malloc(sizeof(*reader));
+    if (!reader) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    sdm_reader_open(reader, file_name);
+    
+    u64 n_grids = 0;
+    u64 n_unsolvable = 0;
+    u64 n_unique = 0;
+    u64 n_multiple = 0;
+    *solve_duration = 0;
+    
+    for (;;) {
+        const char *cells = sdm_reader_next_cells(reader, GRID_CELLS);
+        if (cells == NULL)
+            break;
+        
+        n_grids++;
+        
+        struct GN(grid) initial_state;
+        u32 bad_idx = GN(parse_grid)(cells, &initial_state);
+        if (bad_idx != GRID_CELLS) {
+            char found[8];
+            printf("%s line %"PRIu64", col %"PRIu32": expected a value up to %d but found %s\n", reader->file_name, sdm_reader_line(reader),
+                   bad_idx + 1, GRID_N, printable_char(cells[bad_idx], found));
+            exit(1);
+        }
+        
+        struct GN(grid) solution;
+        double start = monotonic_seconds();
+        u64 n_solutions = GN(solve_grid)(options, &initial_state, &solution, stats);
+        *solve_duration += monotonic_seconds() - start;
+        
+        if (n_solutions == 0) {
+            printf("grid %"PRIu64": has no solution\n", n_grids);
+            n_unsolvable++;
+            continue;
+        }
+        
+        if (n_solutions == 1)
+            n_unique++;
+        else
+            n_multiple++;
+        
+        if (!GN(grid_is_solved)(&solution)) {
+            printf("grid %"PRIu64": "INCORRECT_SOLUTION_BANNER"\n", n_grids);
+            exit(1);
+        }
+    }
+    
+    sdm_reader_close(reader);
+    free(reader);
+    
+    if (options->count_solutions) {
+        printf("%"PRIu64" with a unique solution, %"PRIu64" with more than one, %"PRIu64" with none\n",
+               n_unique, n_multiple, n_unsolvable);
+    } else if (n_unsolvable > 0) {
+        printf("%"PRIu64" grids have no solution\n", n_unsolvable);
+    }
+    
+    return n_grids;
+}
+
+#undef GRID_BOX
+#undef GRID_N
+#undef GRID_CELLS
+#undef GRID_ALL
+#undef GRID_MASK
+#undef GRID_POPCOUNT
+#undef GRID_CELL
+#undef GRID_SUFFIX
+#undef GN_CONCAT_
+#undef GN_CONCAT
+#undef GN
@@ -1,24 +1,200 @@
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <string.h>
+#include <threads.h>
 #include <time.h>
 
+#if defined(_WIN32)
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "sudoku.h"
 #include "types.h"
 
-struct grid {
-    u32 values[9][9];
+// elapsed real time in seconds from an arbitrary start, for measuring durations
+// unlike clock() it does not add up the cpu time of every thread, and unlike the
+// calendar time it does not jump when the system clock is adjusted
+double monotonic_seconds(void) {
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#endif
+}
+
+#if defined(SUDOKU_STATS)
+
+// the stats of the solve running on this thread, set by solve_with_options
+static _Thread_local struct sudoku_solve_stats *active_stats;
+
+#define STAT_ADD(field, n) (active_stats->field += (n))
+
+#define STAT_ENTER_GUESS() \
+    do { \
+        if (++active_stats->depth > active_stats->max_depth) \
+            active_stats->max_depth = active_stats->depth; \
+    } while (0)
+
+#define STAT_BACKTRACK() \
+    do { \
+        active_stats->depth--; \
+        active_stats->backtracks++; \
+    } while (0)
+
+#define STAT_PHASE_START(name) double name = monotonic_seconds()
+#define STAT_PHASE_END(field, name) (active_stats->field += monotonic_seconds() - (name))
+
+#else
+
+#define STAT_ADD(field, n) ((void) 0)
+#define STAT_ENTER_GUESS() ((void) 0)
+#define STAT_BACKTRACK() ((void) 0)
+#define STAT_PHASE_START(name) ((void) 0)
+#define STAT_PHASE_END(field, name) ((void) 0)
+
+#endif
+
+// adds the counters of from into into
+void add_solve_stats(struct sudoku_solve_stats *into, const struct sudoku_solve_stats *from) {
+    into->nodes += from->nodes;
+    into->singles_tier += from->singles_tier;
+    into->engine_tier += from->engine_tier;
+    into->timeouts += from->timeouts;
+    into->requeues += from->requeues;
+    into->restarts += from->restarts;
+    if (from->max_restarts > into->max_restarts)
+        into->max_restarts = from->max_restarts;
+    
+#if defined(SUDOKU_STATS)
+    into->lone_singles += from->lone_singles;
+    into->hidden_singles += from->hidden_singles;
+    into->naked_pair_eliminations += from->naked_pair_eliminations;
+    into->naked_subset_eliminations += from->naked_subset_eliminations;
+    into->hidden_subset_eliminations += from->hidden_subset_eliminations;
+    into->backjumps += from->backjumps;
+    into->nogoods_learned += from->nogoods_learned;
+    into->nogood_hits += from->nogood_hits;
+    for (u32 i = 0; i < SUDOKU_N_TECHNIQUES; i++) {
+        into->technique_hits[i] += from->technique_hits[i];
+        into->technique_eliminations[i] += from->technique_eliminations[i];
+        into->technique_seconds[i] += from->technique_seconds[i];
+    }
+    into->set_value_calls += from->set_value_calls;
+    into->unset_value_calls += from->unset_value_calls;
+    into->backtracks += from->backtracks;
+    if (from->max_depth > into->max_depth)
+        into->max_depth = from->max_depth;
+    into->setup_seconds += from->setup_seconds;
+    into->logic_seconds += from->logic_seconds;
+    into->search_seconds += from->search_seconds;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// search budgets
+//
+// every engine asks out_of_budget before each guess and unwinds as soon as it says yes, so a
+// pathological puzzle costs at most options->node_budget nodes or about options->time_budget_seconds
+// the budget of the solve running on a thread lives in a thread local like active_stats, so the
+// searches do not need another parameter, and without a budget the check is a single compare
+// ---------------------------------------------------------------------------
+
+// reading the clock costs about as much as a few nodes, so the time is only looked at this often
+#define BUDGET_CHECK_INTERVAL 4096
+
+// a search that another thread can cancel looks at the flag (and the clock) this often instead
+#define CANCEL_CHECK_INTERVAL 256
+
+struct search_budget {
+    // the node count at which search_budget_check runs next, at most node_limit
+    u64 next_check;
+    
+    // the node count the search stops at, UINT64_MAX for no limit
+    u64 node_limit;
+    
+    // the monotonic_seconds() the search stops at, 0 for no limit
+    double deadline;
+    
+    // set by another thread to stop the search, NULL if nothing can
+    atomic_bool *cancel;
+    
+    // the budget ran out or the search was cancelled
+    bool exhausted;
 };
 
+static _Thread_local struct search_budget active_budget;
+
+static void search_budget_schedule(struct search_budget *budget, u64 nodes) {
+    budget->next_check = budget->node_limit;
+    if (budget->deadline > 0 && nodes + BUDGET_CHECK_INTERVAL < budget->next_check)
+        budget->next_check = nodes + BUDGET_CHECK_INTERVAL;
+    if (budget->cancel && nodes + CANCEL_CHECK_INTERVAL < budget->next_check)
+        budget->next_check = nodes + CANCEL_CHECK_INTERVAL;
+}
+
+// starts the budget of a search, nodes is what the solve's stats count before it
+// cancel may be NULL
+void search_budget_start(const struct sudoku_solve_options *options, u64 nodes, atomic_bool *cancel) {
+    struct search_budget *budget = &active_budget;
+    
+    budget->node_limit = options->node_budget != 0 && options->node_budget < UINT64_MAX - nodes ? nodes + options->node_budget : UINT64_MAX;
+    budget->deadline = options->time_budget_seconds > 0 ? monotonic_seconds() + options->time_budget_seconds : 0;
+    budget->cancel = cancel;
+    budget->exhausted = false;
+    
+    search_budget_schedule(budget, nodes);
+}
+
+// the slow path of out_of_budget, once the budget has run out it keeps saying so
+bool search_budget_check(u64 nodes) {
+    struct search_budget *budget = &active_budget;
+    
+    if (budget->exhausted)
+        return true;
+    
+    if (nodes >= budget->node_limit || (budget->cancel && atomic_load_explicit(budget->cancel, memory_order_relaxed)) ||
+        (budget->deadline > 0 && monotonic_seconds() >= budget->deadline)) {
+        budget->exhausted = true;
+        return true;
+    }
+    
+    search_budget_schedule(budget, nodes);
+    return false;
+}
+
+// true if the search that has counted nodes so far should give up instead of making another guess
+static inline bool out_of_budget(u64 nodes) {
+    return nodes >= active_budget.next_check && search_budget_check(nodes);
+}
+
 // this is more than enough space for a grid string representation
-static char grid_str_buf[4096];
+#define GRID_STR_SIZE 256
 
-char *make_grid_str(const struct grid *grid) {
+// writes the grid into into, which has room for GRID_STR_SIZE chars, and returns it
+char *make_grid_str(const struct sudoku_grid *grid, char *into) {
     assert(grid);
     
-    char *to_print_to = grid_str_buf;
+    char *to_print_to = into;
     
     for (u32 row_idx = 0; row_idx < 9; row_idx++) {
         for (u32 col_idx = 0; col_idx < 9; col_idx++) {
@@ -46,7 +222,7 @@ char *make_grid_str(const struct grid *grid) {
     
     to_print_to[0] = 0;
     
-    return grid_str_buf;
+    return into;
 }
 
 
@@ -61,7 +237,7 @@ struct is_solved_result {
     u32 err_idx;
 };
 
-struct is_solved_result is_solved(const struct grid *grid) {
+struct is_solved_result is_solved(const struct sudoku_grid *grid) {
     assert(grid);
     
     bool have_value[9];
@@ -152,6 +328,75 @@ struct is_solved_result is_solved(const struct grid *grid) {
     return res;
 }
 
+// more than enough for any message make_error_str writes
+#define ERROR_STR_SIZE 128
+
+// describes what is wrong with a grid is_solved rejected in one line, into has room for ERROR_STR_SIZE chars
+// the command line prints INCORRECT_SOLUTION_BANNER above it, the library hands out the line alone
+#define INCORRECT_SOLUTION_BANNER "INCORRECT SOLUTION!!!"
+
+char *make_error_str(const struct is_solved_result solved, char *into) {
+	char *to_print_to = into;
+
+	switch (solved.err_type) {
+		case ROW_ERROR: {
+			sprintf(to_print_to, "row %"PRIu32" has value %"PRIu32" multiple times", solved.err_idx, solved.err_value);
+		}
+		break;
+		
+		case COL_ERROR: {
+			sprintf(to_print_to, "col %"PRIu32" has value %"PRIu32" multiple times", solved.err_idx, solved.err_value);
+		}
+		break;
+		
+		case BOX_ERROR: {
+			sprintf(to_print_to, "box %"PRIu32" has value %"PRIu32" multiple times", solved.err_idx, solved.err_value);
+		}
+		break;
+
+		case NOT_FILLED_ERROR: {
+			sprintf(to_print_to, "grid is not even fully filled out");
+		}
+		break;
+	}
+
+	return into;
+}
+
+// bit helpers shared by the engines, a 9 bit mask holds the candidates of a cell
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline u32 popcount16(u16 x) { return __popcnt16(x); }
+static inline u32 popcount32(u32 x) { return __popcnt(x); }
+static inline u32 ctz32(u32 x) { unsigned long idx; _BitScanForward(&idx, x); return idx; }
+static inline u32 ctz64(u64 x) { unsigned long idx; _BitScanForward64(&idx, x); return idx; }
+#else
+#if defined(__POPCNT__)
+static inline u32 popcount16(u16 x) { return __builtin_popcount(x); }
+static inline u32 popcount32(u32 x) { return __builtin_popcount(x); }
+#else
+// without the popcnt instruction __builtin_popcount becomes a libgcc call, this is cheaper
+static inline u32 popcount16(u16 x) {
+    u32 v = x;
+    v = v - ((v >> 1) & 0x5555);
+    v = (v & 0x3333) + ((v >> 2) & 0x3333);
+    v = (v + (v >> 4)) & 0x0F0F;
+    return (v + (v >> 8)) & 0x1F;
+}
+
+static inline u32 popcount32(u32 x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+#endif
+static inline u32 ctz32(u32 x) { return __builtin_ctz(x); }
+static inline u32 ctz64(u64 x) { return __builtin_ctzll(x); }
+#endif
+
+#define ALL_CANDIDATES 0x1FF
+
 struct solve_state {
     u32 values[9][9];
     
@@ -160,10 +405,10 @@ struct solve_state {
     s32 collisions[9][9][9];
 };
 
-char *solve_state_str(const struct solve_state *solve_state) {
-    struct grid grid;
+char *solve_state_str(const struct solve_state *solve_state, char *into) {
+    struct sudoku_grid grid;
     memcpy(grid.values, solve_state->values, 81 * sizeof(solve_state->values[0][0]));
-    return make_grid_str(&grid);
+    return make_grid_str(&grid, into);
 }
 
 
@@ -273,6 +518,7 @@ void set_value(struct solve_state *solve_state, u32 row_idx, u32 col_idx, u32 va
     assert(solve_state->values[row_idx][col_idx] == 0);
     
     solve_state->values[row_idx][col_idx] = value;
+    STAT_ADD(set_value_calls, 1);
     
     modify_related_cells_collisions(solve_state, row_idx, col_idx, value, true);
     
@@ -290,12 +536,105 @@ void unset_value(struct solve_state *solve_state, u32 row_idx, u32 col_idx) {
     
     u32 value_at_cell = solve_state->values[row_idx][col_idx];
     solve_state->values[row_idx][col_idx] = 0;
+    STAT_ADD(unset_value_calls, 1);
     
     modify_related_cells_collisions(solve_state, row_idx, col_idx, value_at_cell, false);
 }
 
 
-bool recursive_solve(struct solve_state *solve_state, u32 row_idx, u32 col_idx) {
+// how the searches of the collisions engine pick cells, order values and when they stop to restart
+struct search_control {
+    sudoku_value_order order;
+    
+    // branch on the empty cell with the fewest candidates, ties broken at random, instead of the next
+    // one in row-major order
+    bool random_mrv;
+    
+    // xorshift state for SUDOKU_VALUE_ORDER_RANDOM and the mrv ties, never 0
+    u64 random_state;
+    
+    // the search unwinds once stats->nodes reaches this, and sets restarting
+    u64 restart_at;
+    bool restarting;
+};
+
+static inline u64 next_random(u64 *state) {
+    u64 x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// how many empty peers of [row_idx][col_idx] could still take value
+static u32 peers_with_candidate(const struct solve_state *solve_state, u32 row_idx, u32 col_idx, u32 value) {
+    u32 n_peers = 0;
+    
+    for (u32 other_col = 0; other_col < 9; other_col++) {
+        if (other_col != col_idx && solve_state->values[row_idx][other_col] == 0 && solve_state->collisions[row_idx][other_col][value-1] == 0)
+            n_peers++;
+    }
+    
+    for (u32 other_row = 0; other_row < 9; other_row++) {
+        if (other_row != row_idx && solve_state->values[other_row][col_idx] == 0 && solve_state->collisions[other_row][col_idx][value-1] == 0)
+            n_peers++;
+    }
+    
+    // the rest of the box, its cells in our row and col were counted above
+    u32 box_row_start = box_row_lookup[row_idx][col_idx];
+    u32 box_col_start = box_col_lookup[row_idx][col_idx];
+    for (u32 box_row = box_row_start; box_row < box_row_start + 3; box_row++) {
+        for (u32 box_col = box_col_start; box_col < box_col_start + 3; box_col++) {
+            if (box_row != row_idx && box_col != col_idx && solve_state->values[box_row][box_col] == 0 &&
+                solve_state->collisions[box_row][box_col][value-1] == 0)
+                n_peers++;
+        }
+    }
+    
+    return n_peers;
+}
+
+// puts the values that can go in empty cell [row_idx][col_idx] in the order they should be tried
+// returns how many there are
+u32 ordered_candidates(const struct solve_state *solve_state, struct search_control *control, u32 row_idx, u32 col_idx, u8 values[9]) {
+    const s32 *collisions = solve_state->collisions[row_idx][col_idx];
+    
+    u32 n_values = 0;
+    for (u32 i = 0; i < 9; i++) {
+        if (collisions[i] == 0)
+            values[n_values++] = (u8) (i + 1);
+    }
+    
+    if (control->order == SUDOKU_VALUE_ORDER_LCV) {
+        // insertion sort on the number of peers a value takes a candidate from, ties stay ascending
+        u32 n_constrained[9];
+        for (u32 i = 0; i < n_values; i++) {
+            u8 value = values[i];
+            u32 n = peers_with_candidate(solve_state, row_idx, col_idx, value);
+            
+            u32 j = i;
+            while (j > 0 && n_constrained[j - 1] > n) {
+                values[j] = values[j - 1];
+                n_constrained[j] = n_constrained[j - 1];
+                j--;
+            }
+            values[j] = value;
+            n_constrained[j] = n;
+        }
+    } else if (control->order == SUDOKU_VALUE_ORDER_RANDOM) {
+        for (u32 i = n_values; i > 1; i--) {
+            u32 j = (u32) (next_random(&control->random_state) % i);
+            u8 tmp = values[i - 1];
+            values[i - 1] = values[j];
+            values[j] = tmp;
+        }
+    }
+    
+    return n_values;
+}
+
+bool recursive_solve(struct solve_state *solve_state, struct search_control *control, u32 row_idx, u32 col_idx, struct sudoku_solve_stats *stats) {
     assert(solve_state);
     assert(col_idx < 9);
     
@@ -314,27 +653,37 @@ bool recursive_solve(struct solve_state *solve_state, u32 row_idx, u32 col_idx)
     // don't do anything for it, just keep solving from the next cell
     // this can be repeated all the way to the end of the grid if the rest of the grid is solved
     if (solve_state->values[row_idx][col_idx] != 0) {
-        return recursive_solve(solve_state, next_row_idx, next_col_idx);
+        return recursive_solve(solve_state, control, next_row_idx, next_col_idx, stats);
     }
     
     
-    s32 *collisions = solve_state->collisions[row_idx][col_idx];
+    // the values with collisions are left out, if we placed one of them there would be a collision
+    // taking a value back restores the collisions, so the list stays valid for the whole loop
+    u8 values[9];
+    u32 n_values = ordered_candidates(solve_state, control, row_idx, col_idx, values);
     
-    for (u32 i = 0; i < 9; i++) {
-        if (collisions[i] > 0)
-            // if we tried to place i + 1 at [row_idx][col_idx], there would be collisions, so skip it
-            continue;
+    for (u32 i = 0; i < n_values; i++) {
+        if (out_of_budget(stats->nodes))
+            return false;
+        
+        if (stats->nodes >= control->restart_at) {
+            control->restarting = true;
+            return false;
+        }
         
-        u32 value = i + 1;
+        u32 value = values[i];
         
         set_value(solve_state, row_idx, col_idx, value);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
         //exit(1);
-        bool success = recursive_solve(solve_state, next_row_idx, next_col_idx);
+        bool success = recursive_solve(solve_state, control, next_row_idx, next_col_idx, stats);
         
         if (success) {
             return true;
         } else {
             unset_value(solve_state, row_idx, col_idx);
+            STAT_BACKTRACK();
         }
     }
     
@@ -342,339 +691,660 @@ bool recursive_solve(struct solve_state *solve_state, u32 row_idx, u32 col_idx)
     return false;
 }
 
-// fills out all the cells that can only have one possible value
-// does this repeatedly so that if filling out one cell allows a second to be filled
-// the second cell is filled as well, and so on
-// returns whether at least one cell was filled out
-bool reveal_lone_singles(struct solve_state *solve_state) {
-    bool revealed_at_least_one_in_loop;
-    bool revealed_at_least_one_overall = false;
+// ---------------------------------------------------------------------------
+// candidate mask kernels
+//
+// the logic passes of the collisions engine want to know, for every empty cell, which values
+// have 0 collisions. the 9 counters of a cell are stored back to back, so the whole grid is
+// 729 s32s in a row: the kernels compare all of them to 0 a vector at a time, pack the results
+// into a 729 bit set and then cut a 9 bit candidate mask per cell out of that set
+// which kernel runs is picked at startup from what the cpu supports, the scalar one runs anywhere
+// ---------------------------------------------------------------------------
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SUDOKU_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+// msvc lets any function use any intrinsic, the cpu check is what keeps them from running
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef enum { KERNEL_AUTO, KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2 } kernel_level;
+
+// 729 bits, rounded up so that the 4 byte reads of the last cell stay inside the array
+#define ZERO_BITS_SIZE 96
+
+// cuts the 9 bits of each cell out of the zero collision bit set, filled cells get no candidates
+static inline void masks_from_zero_bits(const struct solve_state *solve_state, const u8 *zero_bits, u16 *masks) {
+    const u32 *values = &solve_state->values[0][0];
     
-    do {
-        revealed_at_least_one_in_loop = false;
-        
-        for (u32 row_idx = 0; row_idx < 9; row_idx++) {
-            for (u32 col_idx = 0; col_idx < 9; col_idx++) {
-                
-                if (solve_state->values[row_idx][col_idx] != 0)
-                    continue;
-                
-                s32 *collisions = solve_state->collisions[row_idx][col_idx];
-                
-                u32 n_possible = 0;
-                for (u32 i = 0; i < 9; i++) {
-                    if(collisions[i] == 0)
-                        n_possible++;
-                }
-                
-                if (n_possible != 1)
-                    continue;
-                
-                revealed_at_least_one_in_loop = true;
-                
-                u32 single_val_idx = -1;
-                for (u32 i = 0; i < 9; i++) {
-                    if (collisions[i] == 0) {
-                        single_val_idx = i;
-                        break;
-                    }
-                }
-                assert(single_val_idx != -1);
-                
-                u32 value = single_val_idx + 1;
-                
-                set_value(solve_state, row_idx, col_idx, value);
-            }
-        }
-        
-        if (revealed_at_least_one_in_loop)
-            revealed_at_least_one_overall = true;
-        
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        u32 bit_idx = cell_idx * 9;
+        u32 word;
+        memcpy(&word, &zero_bits[bit_idx / 8], sizeof(word));
         
-    } while (revealed_at_least_one_in_loop);
-    
-    return revealed_at_least_one_overall;
+        u16 mask = (word >> (bit_idx % 8)) & ALL_CANDIDATES;
+        masks[cell_idx] = values[cell_idx] == 0 ? mask : 0;
+    }
 }
 
-// reveals hidden singles in the solve_state and returns whether at least one cell was revealed
-bool reveal_hidden_singles(struct solve_state *solve_state) {
-    bool revealed_at_least_one_in_loop;
-    bool revealed_at_least_one_overall = false;
-    
-    do {
-        revealed_at_least_one_in_loop = false;
-        
-        // pass over each of the rows
-        for (u32 row_idx = 0; row_idx < 9; row_idx++) {
-            
-            // number of cells in which a value can be placed in current row
-            u32 cells_possible[9] = {0};
-            
-            for (u32 col_idx = 0; col_idx < 9; col_idx++) {
-                if (solve_state->values[row_idx][col_idx] != 0)
-                    continue;
-                
-                s32 *cur_cell_collisions = solve_state->collisions[row_idx][col_idx];
-                for (u32 i = 0; i < 9; i++) {
-                    if (cur_cell_collisions[i] == 0)
-                        cells_possible[i]++;
-                }
-            }
-            
-            
-            // if the number of cells that a value can be placed in is 1, we found a hidden single
-            // and can place it in the single cell for which the value is a candidate
-            for (u32 i = 0; i < 9; i++) {
-                if (cells_possible[i] == 1) {
-                    revealed_at_least_one_in_loop = true;
-                    u32 value = i + 1;
-                    
-                    // find the cell into which we will place the value
-                    for (u32 col_idx = 0; col_idx < 9; col_idx++) {
-                        if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][i] == 0) {
-                            set_value(solve_state, row_idx, col_idx, value);
-                        }
-                    }
-                }
-            }
-            
-        }
-        
-        // pass over each of the columns
+// masks[row * 9 + col] bit i is set if value i + 1 has no collisions at [row][col] and the cell is empty
+void candidate_masks_scalar(const struct solve_state *solve_state, u16 *masks) {
+    for (u32 row_idx = 0; row_idx < 9; row_idx++) {
         for (u32 col_idx = 0; col_idx < 9; col_idx++) {
-            // number of cells in which a value can be placed in current column
-            u32 cells_possible[9] = {0};
+            u16 mask = 0;
             
-            for (u32 row_idx = 0; row_idx < 9; row_idx++) {
-                if (solve_state->values[row_idx][col_idx] != 0)
-                    continue;
-                
-                s32 *cur_cell_collisions = solve_state->collisions[row_idx][col_idx];
+            if (solve_state->values[row_idx][col_idx] == 0) {
+                const s32 *collisions = solve_state->collisions[row_idx][col_idx];
                 for (u32 i = 0; i < 9; i++) {
-                    if (cur_cell_collisions[i] == 0)
-                        cells_possible[i]++;
+                    if (collisions[i] == 0)
+                        mask |= 1 << i;
                 }
             }
             
-            
-            // if the number of cells that a value can be placed in is 1, we found a hidden single
-            // and can place it in the single cell for which the value is a candidate
-            for (u32 i = 0; i < 9; i++) {
-                if (cells_possible[i] == 1) {
-                    revealed_at_least_one_in_loop = true;
-                    u32 value = i + 1;
-                    
-                    // find the cell into which we will place the value
-                    for (u32 row_idx = 0; row_idx < 9; row_idx++) {
-                        if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][i] == 0) {
-                            set_value(solve_state, row_idx, col_idx, value);
-                        }
-                    }
-                }
-            }
-        }
-        
-        // pass over all the boxes
-        {
-            u32 box_row_start = 0;
-            u32 box_row_end = 3;
-            u32 box_col_start = 0;
-            u32 box_col_end = 3;
-            for (u32 box_idx = 0; box_idx < 9; box_idx++) {
-                
-                // cells_possible[i] is number of cells in which value i+1 can be placed in this box
-                u32 cells_possible[9] = {0};
-                
-                for (u32 row_idx = box_row_start; row_idx < box_row_end; row_idx++) {
-                    for (u32 col_idx = box_col_start; col_idx < box_col_end; col_idx++) {
-                        if (solve_state->values[row_idx][col_idx] != 0)
-                            continue;
-                        
-                        s32 *cell_collisions = solve_state->collisions[row_idx][col_idx];
-                        
-                        for (u32 i = 0; i < 9; i++) {
-                            if (cell_collisions[i] == 0) {
-                                cells_possible[i]++;
-                            }
-                        }
-                    }
-                }
-                
-                for (u32 i = 0; i < 9; i++) {
-                    if (cells_possible[i] == 1) {
-                        revealed_at_least_one_in_loop = true;
-                        u32 value = i + 1;
-                        
-                        for (u32 row_idx = box_row_start; row_idx < box_row_end; row_idx++) {
-                            for (u32 col_idx = box_col_start; col_idx < box_col_end; col_idx++) {
-                                if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][i] == 0) {
-                                    
-                                    set_value(solve_state, row_idx, col_idx, value);
-                                }
-                            }
-                        }
-                    }
-                }
-                
-                
-                box_col_start += 3;
-                box_col_end += 3;
-                if (box_col_start == 9) {
-                    box_row_start += 3;
-                    box_row_end += 3;
-                    box_col_start = 0;
-                    box_col_end = 3;
-                }
-            }
+            masks[row_idx * 9 + col_idx] = mask;
         }
+    }
+}
+
+#if defined(SUDOKU_X86_64)
+
+// sets the bits of the counters in [begin, 729) that are 0, 16 counters at a time, begin must be a multiple of 16
+static inline void zero_bits_sse2(const s32 *collisions, u32 begin, u8 *zero_bits) {
+    const __m128i zero = _mm_setzero_si128();
+    
+    u32 i = begin;
+    for (; i + 16 <= 729; i += 16) {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &collisions[i]), zero);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &collisions[i + 4]), zero);
+        __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &collisions[i + 8]), zero);
+        __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &collisions[i + 12]), zero);
         
-        if (revealed_at_least_one_in_loop)
-            revealed_at_least_one_overall = true;
+        // the compares give 0 or -1, packing keeps that and the order, one byte per counter
+        __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        u16 bits = (u16) _mm_movemask_epi8(bytes);
+        memcpy(&zero_bits[i / 8], &bits, sizeof(bits));
+    }
+    
+    // 729 is 9 past a multiple of 16
+    u16 tail = 0;
+    for (u32 j = 0; i + j < 729; j++) {
+        if (collisions[i + j] == 0)
+            tail |= 1 << j;
+    }
+    memcpy(&zero_bits[i / 8], &tail, sizeof(tail));
+}
+
+void candidate_masks_sse2(const struct solve_state *solve_state, u16 *masks) {
+    u8 zero_bits[ZERO_BITS_SIZE] = {0};
+    zero_bits_sse2(&solve_state->collisions[0][0][0], 0, zero_bits);
+    masks_from_zero_bits(solve_state, zero_bits, masks);
+}
+
+TARGET_AVX2
+void candidate_masks_avx2(const struct solve_state *solve_state, u16 *masks) {
+    const s32 *collisions = &solve_state->collisions[0][0][0];
+    const __m256i zero = _mm256_setzero_si256();
+    
+    // the packs work within each 128 bit half, this puts the 4 byte groups back in order
+    const __m256i unshuffle = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    
+    u8 zero_bits[ZERO_BITS_SIZE] = {0};
+    
+    u32 i = 0;
+    for (; i + 32 <= 729; i += 32) {
+        __m256i a = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &collisions[i]), zero);
+        __m256i b = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &collisions[i + 8]), zero);
+        __m256i c = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &collisions[i + 16]), zero);
+        __m256i d = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &collisions[i + 24]), zero);
         
-        // keep performing the passes until no more hidden singles are revealed
-    } while (revealed_at_least_one_in_loop);
+        __m256i bytes = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        bytes = _mm256_permutevar8x32_epi32(bytes, unshuffle);
+        u32 bits = (u32) _mm256_movemask_epi8(bytes);
+        memcpy(&zero_bits[i / 8], &bits, sizeof(bits));
+    }
     
+    // the last 25 counters
+    zero_bits_sse2(collisions, i, zero_bits);
     
-    return revealed_at_least_one_overall;
+    masks_from_zero_bits(solve_state, zero_bits, masks);
 }
 
+// whether the cpu and the os (which has to save the ymm registers) support avx2
+bool cpu_has_avx2(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    
+    __cpuid(info, 1);
+    bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    bool has_avx = (info[2] & (1 << 28)) != 0;
+    if (!has_osxsave || !has_avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
 
-struct cell_with_2_candidates {
-	u32 row, col, box;
-	u32 candidates[2];
-};
-
-u32 find_all_cells_with_2_candidates(const struct solve_state *solve_state, struct cell_with_2_candidates *into) {
-	u32 candidate_counts[9][9] = {0};
-	
-	for (u32 r = 0; r < 9; r++)
-		for(u32 c = 0; c < 9; c++)
-			for (u32 i = 0; i < 9; i++)
-				if (solve_state->values[r][c] == 0 && solve_state->collisions[r][c][i] == 0)
-					candidate_counts[r][c]++;
-	
-	u32 n_cells = 0;
-	for (u32 r = 0; r < 9; r++) {
-		for (u32 c = 0; c < 9; c++) {
-			if (candidate_counts[r][c] == 2) {
-				struct cell_with_2_candidates cell;
-				cell.row = r;
-				cell.col = c;
-				cell.box = box_index_lookup[r][c];
-			
-				u32 candidate_idx = 0;
-				for (u32 i = 0; candidate_idx < 2; i++)
-					if (solve_state->collisions[r][c][i] == 0)
-						cell.candidates[candidate_idx++] = i;
-
-				into[n_cells] = cell;
-				n_cells++;
-			}
-		}
-	}
+#endif
 
-	return n_cells;
-}
+// the kernel used by the logic passes, scalar until select_simd_kernels picks another one
+void (*candidate_masks)(const struct solve_state *solve_state, u16 *masks) = candidate_masks_scalar;
 
-bool reveal_naked_pairs(struct solve_state *solve_state) {
-	bool found_naked_pair_last_iter;
-	bool found_naked_pair_overall = false;
 
-	do {
-		found_naked_pair_last_iter = false;
-		
-		struct cell_with_2_candidates cells_with_2_candidates[81];
-		u32 n_cells = find_all_cells_with_2_candidates(solve_state, cells_with_2_candidates);
-		
-		for (u32 i = 0; i < n_cells; i++) {
-			struct cell_with_2_candidates cell1 = cells_with_2_candidates[i];
-
-			for (u32 j = i+1; j < n_cells; j++) {
-				
-				struct cell_with_2_candidates cell2 = cells_with_2_candidates[j];
-				
-				if (cell1.candidates[0] == cell2.candidates[0] && cell1.candidates[1] == cell2.candidates[1]) {
-					
-					u32 candidate1 = cell1.candidates[0];
-					u32 candidate2 = cell1.candidates[1];
-
-					if (cell1.row == cell2.row) {
-						u32 row_idx = cell1.row;
-						
-						for (u32 col_idx = 0; col_idx < 9; col_idx++) {
-							if (col_idx != cell1.col && col_idx != cell2.col) {
-								if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][candidate1] == 0) {
-									solve_state->collisions[row_idx][col_idx][candidate1]++;
-									found_naked_pair_last_iter = true;
-								}
-								if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][candidate2] == 0) {
-									solve_state->collisions[row_idx][col_idx][candidate2]++;
-									found_naked_pair_last_iter = true;
-								}
-							}
-						}
-					}
-						
-					if (cell1.col == cell2.col) {
-						u32 col_idx = cell1.col;
-	
-						for (u32 row_idx = 0; row_idx < 9; row_idx++) {
-							if (row_idx != cell1.row && row_idx != cell2.row) {
-								if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][candidate1] == 0) {
-									solve_state->collisions[row_idx][col_idx][candidate1]++;
-									found_naked_pair_last_iter = true;
-								}
-								
-								if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][candidate2] == 0) {
-									solve_state->collisions[row_idx][col_idx][candidate2]++;
-									found_naked_pair_last_iter = true;
-								}
-							}
-						}
-					}
-
-					if (cell1.box == cell2.box) {
-						u32 box_idx = cell1.box;
-
-						u32 box_row_start = box_row_lookup[cell1.row][cell1.col];
-						u32 box_row_end = box_row_start + 3;
-						u32 box_col_start = box_col_lookup[cell1.row][cell1.col];
-						u32 box_col_end = box_col_start + 3;
-						
-						for (u32 row_idx = box_row_start; row_idx < box_row_end; row_idx++) {
-							for (u32 col_idx = box_col_start; col_idx < box_col_end; col_idx++) {
-								if ((row_idx != cell1.row || col_idx != cell1.col) && (row_idx != cell2.row || col_idx != cell2.col)) {
-									if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][candidate1] == 0) {
-										solve_state->collisions[row_idx][col_idx][candidate1]++;
-										found_naked_pair_last_iter = true;
-									}
-									if (solve_state->values[row_idx][col_idx] == 0 && solve_state->collisions[row_idx][col_idx][candidate2] == 0) {
-										solve_state->collisions[row_idx][col_idx][candidate2]++;
-										found_naked_pair_last_iter = true;
-									}
-								}
-							}
-						}
-					}
-				}
-			}
-			
-		}
+// defined with the bitmask engine below
+extern const u8 unit_cells[27][9];
 
-		if (found_naked_pair_last_iter)
-			found_naked_pair_overall = true;
+// what the singles passes still have to look at, see propagate_singles
+struct propagation_queue {
+    // the candidates of every cell, kept exact as values are placed and candidates eliminated
+    // filled cells have no candidates
+    u16 masks[81];
+    
+    // cells whose candidates changed since they were last looked at, a ring of up to 81 cells
+    // queued[cell] is set while a cell is in it
+    u8 cells[81];
+    u32 head;
+    u32 n_cells;
+    bool queued[81];
+    
+    // bit unit_idx is set if a cell of that unit changed since the unit was last looked at,
+    // rows are units 0-8, columns 9-17 and boxes 18-26 like in unit_cells
+    u32 dirty_units;
+    
+    // the same for the units reveal_subsets has to search again
+    u32 subset_units;
+};
 
-	} while(found_naked_pair_last_iter);
+// starts with every cell and unit to look at
+void propagation_queue_init(const struct solve_state *solve_state, struct propagation_queue *queue) {
+    candidate_masks(solve_state, queue->masks);
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        queue->cells[cell_idx] = (u8) cell_idx;
+        queue->queued[cell_idx] = true;
+    }
+    queue->head = 0;
+    queue->n_cells = 81;
+    queue->dirty_units = (1u << 27) - 1;
+    queue->subset_units = (1u << 27) - 1;
+}
 
-	return found_naked_pair_overall;
+// the candidates of cell_idx lost the values in removed
+static inline void propagation_queue_cell(struct propagation_queue *queue, u32 cell_idx, u16 removed) {
+    queue->masks[cell_idx] &= ~removed;
+    
+    u32 row_idx = cell_idx / 9;
+    u32 col_idx = cell_idx % 9;
+    u32 units = (1u << row_idx) | (1u << (9 + col_idx)) | (1u << (18 + box_index_lookup[row_idx][col_idx]));
+    queue->dirty_units |= units;
+    queue->subset_units |= units;
+    
+    if (queue->queued[cell_idx])
+        return;
+    
+    queue->queued[cell_idx] = true;
+    queue->cells[(queue->head + queue->n_cells) % 81] = (u8) cell_idx;
+    queue->n_cells++;
 }
 
-void initialize_solve_state_collisions(struct solve_state *solve_state) {
-    // our initial state is that all the values are possible for each cell (aka 0 collisions)
-    memset(solve_state->collisions, 0, 9 * 9 * 9 * sizeof(solve_state->collisions[0][0][0]));
+// places value at cell_idx and queues the peers that lose it as a candidate
+void propagation_place(struct solve_state *solve_state, struct propagation_queue *queue, u32 cell_idx, u32 value) {
+    u32 row_idx = cell_idx / 9;
+    u32 col_idx = cell_idx % 9;
     
-    for (u32 row_idx = 0; row_idx < 9; row_idx++) {
-        for (u32 col_idx = 0; col_idx < 9; col_idx++) {
+    set_value(solve_state, row_idx, col_idx, value);
+    propagation_queue_cell(queue, cell_idx, ALL_CANDIDATES);
+    
+    // cells in two of the units are simply looked at twice, the second time they have nothing to lose
+    u16 bit = (u16) (1 << (value - 1));
+    u32 units[3] = { row_idx, 9 + col_idx, 18 + box_index_lookup[row_idx][col_idx] };
+    for (u32 i = 0; i < 3; i++) {
+        for (u32 j = 0; j < 9; j++) {
+            u32 peer_idx = unit_cells[units[i]][j];
+            if (queue->masks[peer_idx] & bit)
+                propagation_queue_cell(queue, peer_idx, bit);
+        }
+    }
+}
+
+// removes candidate (0-8) from the empty cell [row_idx][col_idx] if it still has it and queues the cell,
+// returns whether it was removed
+bool propagation_eliminate(struct solve_state *solve_state, struct propagation_queue *queue, u32 row_idx, u32 col_idx, u32 candidate) {
+    if (solve_state->values[row_idx][col_idx] != 0 || solve_state->collisions[row_idx][col_idx][candidate] != 0)
+        return false;
+    
+    solve_state->collisions[row_idx][col_idx][candidate]++;
+    propagation_queue_cell(queue, row_idx * 9 + col_idx, (u16) (1 << candidate));
+    return true;
+}
+
+// fills out lone singles (cells with one candidate) and hidden singles (values with one cell left
+// in a unit) until there are none left, but only looks at the cells whose candidates changed and the
+// units holding them, so the cost follows the number of changes instead of rescanning the grid
+// returns whether at least one cell was filled out
+bool propagate_singles(struct solve_state *solve_state, struct propagation_queue *queue) {
+    bool placed_at_least_one = false;
+    
+    for (;;) {
+        // lone singles first, a changed cell is a single popcount
+        while (queue->n_cells > 0) {
+            u32 cell_idx = queue->cells[queue->head];
+            queue->head = (queue->head + 1) % 81;
+            queue->n_cells--;
+            queue->queued[cell_idx] = false;
+            
+            // filled cells have no candidates, and an empty cell without any is left to the search
+            u16 mask = queue->masks[cell_idx];
+            if (popcount16(mask) != 1)
+                continue;
+            
+            propagation_place(solve_state, queue, cell_idx, ctz32(mask) + 1);
+            STAT_ADD(lone_singles, 1);
+            placed_at_least_one = true;
+        }
+        
+        if (queue->dirty_units == 0)
+            return placed_at_least_one;
+        
+        u32 unit_idx = ctz32(queue->dirty_units);
+        queue->dirty_units &= queue->dirty_units - 1;
+        const u8 *unit = unit_cells[unit_idx];
+        
+        // values that can be placed in at least one and in at least two cells of the unit
+        u16 seen_once = 0;
+        u16 seen_twice = 0;
+        for (u32 i = 0; i < 9; i++) {
+            u16 mask = queue->masks[unit[i]];
+            seen_twice |= seen_once & mask;
+            seen_once |= mask;
+        }
+        
+        u16 hidden_singles = seen_once & ~seen_twice;
+        while (hidden_singles) {
+            u32 value = ctz32(hidden_singles) + 1;
+            hidden_singles &= hidden_singles - 1;
+            
+            // the cell is gone if it was the only one for an earlier value too, the search finds out
+            for (u32 i = 0; i < 9; i++) {
+                if (queue->masks[unit[i]] & (1 << (value - 1))) {
+                    propagation_place(solve_state, queue, unit[i], value);
+                    STAT_ADD(hidden_singles, 1);
+                    placed_at_least_one = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// naked and hidden subsets
+//
+// a naked subset is n cells of a unit whose candidates together are n values, those values can
+// then go nowhere else in the unit; a hidden subset is n values that together fit in only n
+// cells of a unit, those cells can then hold nothing else
+// both are the same search over 9 masks: the candidates of each cell for naked subsets, and the
+// cells each value fits in for hidden ones, so one finder serves both, for n = 2, 3 and 4
+// (bigger naked subsets are smaller hidden ones and the other way around)
+// only the units the propagation queue marked as changed are searched
+// ---------------------------------------------------------------------------
+
+#define MAX_SUBSET_SIZE 4
+
+// finds between 2 and max_size of masks[first..9), each with 2 to max_size bits, that together have
+// as many bits as there are of them and share one with some other mask, the n_chosen items already
+// in chosen have united as their masks together
+// returns the chosen items as bits with their union in *into_united, or 0 if there are none
+static u32 find_subset(const u16 masks[9], u32 max_size, u32 first, u32 n_chosen, u32 chosen, u16 united, u16 *into_united) {
+    for (u32 i = first; i < 9; i++) {
+        u32 n_bits = popcount16(masks[i]);
+        if (n_bits < 2 || n_bits > max_size)
+            continue;
+        
+        u16 with_i = united | masks[i];
+        u32 n_united = popcount16(with_i);
+        if (n_united > max_size)
+            continue;
+        
+        u32 chosen_with_i = chosen | (1u << i);
+        
+        if (n_united == n_chosen + 1) {
+            for (u32 other = 0; other < 9; other++) {
+                if (!(chosen_with_i & (1u << other)) && (masks[other] & with_i)) {
+                    *into_united = with_i;
+                    return chosen_with_i;
+                }
+            }
+            
+            // nothing else in the unit overlaps the subset, and adding a mask that does not
+            // overlap it either can only add more bits than items
+            continue;
+        }
+        
+        if (n_chosen + 1 < max_size) {
+            u32 found = find_subset(masks, max_size, i + 1, n_chosen + 1, chosen_with_i, with_i, into_united);
+            if (found)
+                return found;
+        }
+    }
+    
+    return 0;
+}
+
+// removes the candidates in removed (bit i is value i + 1) from cell_idx
+static void eliminate_candidates(struct solve_state *solve_state, struct propagation_queue *queue, u32 cell_idx, u16 removed) {
+    while (removed) {
+        u32 candidate = ctz32(removed);
+        removed &= removed - 1;
+        propagation_eliminate(solve_state, queue, cell_idx / 9, cell_idx % 9, candidate);
+    }
+}
+
+// looks for the first naked or hidden subset with something to eliminate in one of the units that
+// changed since they were last searched and eliminates it, returns false if there is none
+// the cells that lose candidates are queued for propagate_singles
+bool reveal_subsets(struct solve_state *solve_state, struct propagation_queue *queue) {
+    while (queue->subset_units) {
+        u32 unit_idx = ctz32(queue->subset_units);
+        const u8 *unit = unit_cells[unit_idx];
+        
+        // a naked subset of n of the unit's empty cells leaves a hidden one in the others and the
+        // other way around, so looking for both up to half the empty cells finds every subset
+        u16 cell_masks[9];
+        u32 n_empty = 0;
+        for (u32 i = 0; i < 9; i++) {
+            cell_masks[i] = queue->masks[unit[i]];
+            n_empty += cell_masks[i] != 0;
+        }
+        
+        u32 max_size = n_empty / 2 < MAX_SUBSET_SIZE ? n_empty / 2 : MAX_SUBSET_SIZE;
+        if (max_size < 2) {
+            queue->subset_units &= queue->subset_units - 1;
+            continue;
+        }
+        
+        // value_masks[v] are the cells value v + 1 fits in
+        u16 value_masks[9] = {0};
+        for (u32 i = 0; i < 9; i++) {
+            for (u16 candidates = cell_masks[i]; candidates; candidates &= candidates - 1)
+                value_masks[ctz32(candidates)] |= (u16) (1 << i);
+        }
+        
+        u16 values;
+        u32 cells = find_subset(cell_masks, max_size, 0, 0, 0, 0, &values);
+        if (cells) {
+            // the values of the subset go nowhere else in the unit
+            for (u32 i = 0; i < 9; i++) {
+                if (!(cells & (1u << i)) && (cell_masks[i] & values)) {
+                    if (popcount32(cells) == 2)
+                        STAT_ADD(naked_pair_eliminations, popcount16(cell_masks[i] & values));
+                    else
+                        STAT_ADD(naked_subset_eliminations, popcount16(cell_masks[i] & values));
+                    eliminate_candidates(solve_state, queue, unit[i], cell_masks[i] & values);
+                }
+            }
+            return true;
+        }
+        
+        u16 subset_cells;
+        u32 subset_values = find_subset(value_masks, max_size, 0, 0, 0, 0, &subset_cells);
+        if (subset_values) {
+            // the cells of the subset hold nothing but its values
+            for (u32 i = 0; i < 9; i++) {
+                if (subset_cells & (1u << i)) {
+                    STAT_ADD(hidden_subset_eliminations, popcount16(cell_masks[i] & ~subset_values));
+                    eliminate_candidates(solve_state, queue, unit[i], (u16) (cell_masks[i] & ~subset_values));
+                }
+            }
+            return true;
+        }
+        
+        // nothing here until one of its cells changes again
+        queue->subset_units &= queue->subset_units - 1;
+    }
+    
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// intersections and fish
+//
+// the techniques sudoku_solve_options.techniques turns on one by one, shared by the collisions and
+// bitmask engines: each pass gets the candidates of every cell (0 for a filled cell) and marks
+// what it can eliminate, the engine then takes that out of its own state
+// they are tried in the order of their bits, cheapest first, and the first one that finds
+// anything hands the grid back to the singles, which cost far less than any of them
+// ---------------------------------------------------------------------------
+
+// marks the candidates of cell_idx in values as eliminated, returns whether it had any left to mark
+static inline bool mark_eliminated(const u16 masks[81], u16 removed[81], u32 cell_idx, u16 values) {
+    u16 eliminated = masks[cell_idx] & values & ~removed[cell_idx];
+    removed[cell_idx] |= eliminated;
+    return eliminated != 0;
+}
+
+// whether cell_idx is in the row or col line_idx (a unit index below 18)
+static inline bool cell_in_line(u32 line_idx, u32 cell_idx) {
+    return line_idx < 9 ? cell_idx / 9 == line_idx : cell_idx % 9 == line_idx - 9;
+}
+
+// a row or col crosses 3 boxes, segment (0-2) is which of the 3, returns the box index
+static inline u32 segment_box(u32 line_idx, u32 segment) {
+    return line_idx < 9 ? line_idx / 3 * 3 + segment : segment * 3 + (line_idx - 9) / 3;
+}
+
+// looks at the 3 cells where each row and col crosses each box: a value that fits nowhere else in the
+// box goes from the rest of the line (pointing), and with pointing false, a value that fits nowhere
+// else in the line goes from the rest of the box (box-line reduction)
+static bool find_intersections(const u16 masks[81], u16 removed[81], bool pointing) {
+    bool found = false;
+    
+    for (u32 line_idx = 0; line_idx < 18; line_idx++) {
+        const u8 *line = unit_cells[line_idx];
+        
+        u16 segments[3];
+        for (u32 segment = 0; segment < 3; segment++)
+            segments[segment] = masks[line[segment * 3]] | masks[line[segment * 3 + 1]] | masks[line[segment * 3 + 2]];
+        
+        for (u32 segment = 0; segment < 3; segment++) {
+            u16 line_rest = segments[(segment + 1) % 3] | segments[(segment + 2) % 3];
+            
+            const u8 *box = unit_cells[18 + segment_box(line_idx, segment)];
+            u16 box_rest = 0;
+            for (u32 i = 0; i < 9; i++) {
+                if (!cell_in_line(line_idx, box[i]))
+                    box_rest |= masks[box[i]];
+            }
+            
+            if (pointing) {
+                u16 confined = segments[segment] & ~box_rest;
+                if (!(confined & line_rest))
+                    continue;
+                
+                for (u32 i = 0; i < 9; i++) {
+                    if (i / 3 != segment)
+                        found |= mark_eliminated(masks, removed, line[i], confined);
+                }
+            } else {
+                u16 confined = segments[segment] & ~line_rest;
+                if (!(confined & box_rest))
+                    continue;
+                
+                for (u32 i = 0; i < 9; i++) {
+                    if (!cell_in_line(line_idx, box[i]))
+                        found |= mark_eliminated(masks, removed, box[i], confined);
+                }
+            }
+        }
+    }
+    
+    return found;
+}
+
+static bool find_pointing(const u16 masks[81], u16 removed[81]) {
+    return find_intersections(masks, removed, true);
+}
+
+static bool find_box_line(const u16 masks[81], u16 removed[81]) {
+    return find_intersections(masks, removed, false);
+}
+
+// the base lines of a fish hold value_bit only in the cover lines, which are cols when by_cols is
+// false and rows otherwise, so it goes from every other cell of the cover lines
+// does nothing unless there are as many cover lines as base lines
+static bool eliminate_fish(const u16 masks[81], u16 removed[81], bool by_cols, u16 value_bit, u16 base, u16 cover) {
+    if (popcount16(cover) != popcount16(base))
+        return false;
+    
+    bool found = false;
+    for (u32 cover_line = 0; cover_line < 9; cover_line++) {
+        if (!(cover & (1 << cover_line)))
+            continue;
+        
+        for (u32 line = 0; line < 9; line++) {
+            if (base & (1 << line))
+                continue;
+            
+            u32 cell_idx = by_cols ? cover_line * 9 + line : line * 9 + cover_line;
+            found |= mark_eliminated(masks, removed, cell_idx, value_bit);
+        }
+    }
+    
+    return found;
+}
+
+// x-wing (size 2) and swordfish (size 3), with rows as the base lines and then with cols
+static bool find_fish(const u16 masks[81], u16 removed[81], u32 size) {
+    bool found = false;
+    
+    for (u32 value_idx = 0; value_idx < 9; value_idx++) {
+        u16 value_bit = (u16) (1 << value_idx);
+        
+        // positions[0][row] are the cols of the row the value fits in, positions[1][col] the rows of the col
+        u16 positions[2][9] = {{0}};
+        for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+            if (masks[cell_idx] & value_bit) {
+                positions[0][cell_idx / 9] |= (u16) (1 << (cell_idx % 9));
+                positions[1][cell_idx % 9] |= (u16) (1 << (cell_idx / 9));
+            }
+        }
+        
+        for (u32 by_cols = 0; by_cols < 2; by_cols++) {
+            const u16 *lines = positions[by_cols];
+            
+            // only lines where the value has 2 to size cells can be part of the fish, one cell is a hidden single
+            u8 candidates[9];
+            u32 n_candidates = 0;
+            for (u32 line = 0; line < 9; line++) {
+                u32 n_cells = popcount16(lines[line]);
+                if (n_cells >= 2 && n_cells <= size)
+                    candidates[n_candidates++] = (u8) line;
+            }
+            
+            for (u32 i = 0; i < n_candidates; i++) {
+                for (u32 j = i + 1; j < n_candidates; j++) {
+                    u16 base = (u16) ((1 << candidates[i]) | (1 << candidates[j]));
+                    u16 cover = lines[candidates[i]] | lines[candidates[j]];
+                    
+                    if (size == 2) {
+                        found |= eliminate_fish(masks, removed, by_cols, value_bit, base, cover);
+                        continue;
+                    }
+                    
+                    if (popcount16(cover) > size)
+                        continue;
+                    
+                    for (u32 k = j + 1; k < n_candidates; k++) {
+                        found |= eliminate_fish(masks, removed, by_cols, value_bit, (u16) (base | (1 << candidates[k])),
+                                                cover | lines[candidates[k]]);
+                    }
+                }
+            }
+        }
+    }
+    
+    return found;
+}
+
+static bool find_x_wing(const u16 masks[81], u16 removed[81]) {
+    return find_fish(masks, removed, 2);
+}
+
+static bool find_swordfish(const u16 masks[81], u16 removed[81]) {
+    return find_fish(masks, removed, 3);
+}
+
+// in the order of the SUDOKU_TECHNIQUE_* bits
+typedef bool (*technique_pass)(const u16 masks[81], u16 removed[81]);
+
+static const technique_pass technique_passes[SUDOKU_N_TECHNIQUES] = {
+    find_pointing, find_box_line, find_x_wing, find_swordfish
+};
+
+const char *technique_names[SUDOKU_N_TECHNIQUES] = {
+    "pointing", "box_line", "x_wing", "swordfish"
+};
+
+// runs the passes turned on in techniques until one of them finds something, removed[cell] then
+// holds the candidates of cell to eliminate, returns false if none of them found anything
+bool find_technique_eliminations(u32 techniques, const u16 masks[81], u16 removed[81]) {
+    memset(removed, 0, 81 * sizeof(removed[0]));
+    
+    for (u32 technique_idx = 0; technique_idx < SUDOKU_N_TECHNIQUES; technique_idx++) {
+        if (!(techniques & (1u << technique_idx)))
+            continue;
+        
+        STAT_PHASE_START(technique_start);
+        bool found = technique_passes[technique_idx](masks, removed);
+        STAT_PHASE_END(technique_seconds[technique_idx], technique_start);
+        
+        if (found) {
+#if defined(SUDOKU_STATS)
+            STAT_ADD(technique_hits[technique_idx], 1);
+            for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+                STAT_ADD(technique_eliminations[technique_idx], popcount16(removed[cell_idx]));
+#endif
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// eliminates what the first fruitful technique found and queues the cells for propagate_singles,
+// returns false if none of them found anything
+bool reveal_techniques(struct solve_state *solve_state, struct propagation_queue *queue, u32 techniques) {
+    if (techniques == 0)
+        return false;
+    
+    u16 removed[81];
+    if (!find_technique_eliminations(techniques, queue->masks, removed))
+        return false;
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        if (removed[cell_idx])
+            eliminate_candidates(solve_state, queue, cell_idx, removed[cell_idx]);
+    }
+    return true;
+}
+
+void initialize_solve_state_collisions(struct solve_state *solve_state) {
+    // our initial state is that all the values are possible for each cell (aka 0 collisions)
+    memset(solve_state->collisions, 0, 9 * 9 * 9 * sizeof(solve_state->collisions[0][0][0]));
+    
+    for (u32 row_idx = 0; row_idx < 9; row_idx++) {
+        for (u32 col_idx = 0; col_idx < 9; col_idx++) {
             
             // if this cell already has a value, that means it is part of the initial state
             // so just skip it
@@ -720,246 +1390,5563 @@ void initialize_solve_state_collisions(struct solve_state *solve_state) {
 }
 
 
-void solve(const struct grid *initial_state, struct grid *into) {
-    assert(initial_state);
+// returns whether two givens of the puzzle share a value in a row, col or box
+bool has_conflicting_givens(const struct sudoku_grid *grid) {
+    u16 row_used[9] = {0};
+    u16 col_used[9] = {0};
+    u16 box_used[9] = {0};
     
-    struct solve_state solve_state;
-    memcpy(solve_state.values, initial_state->values, sizeof(solve_state.values[0][0]) * 81);
+    for (u32 row_idx = 0; row_idx < 9; row_idx++) {
+        for (u32 col_idx = 0; col_idx < 9; col_idx++) {
+            u32 value = grid->values[row_idx][col_idx];
+            if (value == 0)
+                continue;
+            
+            u16 bit = (u16) (1 << (value - 1));
+            u32 box_idx = box_index_lookup[row_idx][col_idx];
+            
+            if ((row_used[row_idx] | col_used[col_idx] | box_used[box_idx]) & bit)
+                return true;
+            
+            row_used[row_idx] |= bit;
+            col_used[col_idx] |= bit;
+            box_used[box_idx] |= bit;
+        }
+    }
     
-    initialize_solve_state_collisions(&solve_state);
+    return false;
+}
 
-    {
-        bool revealed_at_least_one;
+// ---------------------------------------------------------------------------
+// randomized mrv
+//
+// with mrv the collisions searches branch on the empty cell with the fewest candidates instead of
+// going in row-major order, and break the (many) ties at random from the seed: on
+// data/hard_diagonals.sdm random ties take half the nodes of always taking the first tied cell
+// ---------------------------------------------------------------------------
+
+// picks the empty cell with the fewest candidates, uniformly among the ties, returns false if the grid
+// is filled out, *n_candidates is 0 for a dead end
+static bool pick_random_mrv_cell(const struct solve_state *solve_state, struct search_control *control, u32 *into_cell_idx,
+                                 u32 *n_candidates) {
+    u16 masks[81];
+    candidate_masks(solve_state, masks);
+    
+    const u32 *values = &solve_state->values[0][0];
+    u32 fewest = 10;
+    u32 n_ties = 0;
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        if (values[cell_idx] != 0)
+            continue;
         
-        do {
-            revealed_at_least_one = false;
-            
-            bool found_lone_singles = reveal_lone_singles(&solve_state);
+        u32 count = popcount16(masks[cell_idx]);
+        if (count < fewest) {
+            fewest = count;
+            n_ties = 0;
+        }
+        
+        // the n-th tie replaces the pick with probability 1/n
+        if (count == fewest && next_random(&control->random_state) % ++n_ties == 0)
+            *into_cell_idx = cell_idx;
+        
+        if (fewest == 0)
+            break;
+    }
+    
+    *n_candidates = fewest;
+    return n_ties > 0;
+}
 
-            bool found_hidden_singles = reveal_hidden_singles(&solve_state);
+// recursive_solve with the cells taken in the order above
+bool random_mrv_solve(struct solve_state *solve_state, struct search_control *control, struct sudoku_solve_stats *stats) {
+    u32 cell_idx, n_candidates;
+    if (!pick_random_mrv_cell(solve_state, control, &cell_idx, &n_candidates))
+        return true;
+    if (n_candidates == 0)
+        return false;
+    
+    u32 row_idx = cell_idx / 9;
+    u32 col_idx = cell_idx % 9;
+    u8 values[9];
+    u32 n_values = ordered_candidates(solve_state, control, row_idx, col_idx, values);
+    
+    for (u32 i = 0; i < n_values; i++) {
+        if (out_of_budget(stats->nodes))
+            return false;
+        
+        if (stats->nodes >= control->restart_at) {
+            control->restarting = true;
+            return false;
+        }
+        
+        set_value(solve_state, row_idx, col_idx, values[i]);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (random_mrv_solve(solve_state, control, stats))
+            return true;
+        
+        unset_value(solve_state, row_idx, col_idx);
+        STAT_BACKTRACK();
+    }
+    
+    return false;
+}
 
-			bool found_naked_pairs = reveal_naked_pairs(&solve_state);
+// ---------------------------------------------------------------------------
+// conflict-directed backjumping
+//
+// the same search as recursive_solve, over the empty cells in row-major order (or with randomized mrv,
+// the cell of a level is then picked when the search gets there), but every dead end
+// knows which earlier guesses caused it: a value is ruled out by the earliest guess that placed it in
+// a peer, and a cell that runs out of values blames the union of what ruled out each of its values
+// a guess that is not in that set could not have caused the failure, so the search jumps straight
+// back over it to the deepest guess that is, instead of trying the other values of every cell in between
+// the guesses of such a set can never all hold at once, so small sets are also kept as nogoods in a
+// bounded cache, and a value that would complete one is ruled out without searching below it again
+// ---------------------------------------------------------------------------
 
-            revealed_at_least_one |= found_lone_singles | found_hidden_singles | found_naked_pairs;
-        } while (revealed_at_least_one);
-    }
-	
-	char *grid_str = solve_state_str(&solve_state);
-	//printf("grid state after all passes: \n%s\n", grid_str);
+// a set of search levels, one bit per empty cell
+struct level_set {
+    u64 bits[2];
+};
 
-    bool success = recursive_solve(&solve_state, 0, 0);
-	assert(success);
+static inline void level_set_add(struct level_set *set, u32 level) {
+    set->bits[level / 64] |= (u64) 1 << (level % 64);
+}
 
-    memcpy(into->values, solve_state.values, 81 * sizeof(into->values[0][0]));
+static inline void level_set_remove(struct level_set *set, u32 level) {
+    set->bits[level / 64] &= ~((u64) 1 << (level % 64));
 }
 
-// .ss file looks like
-// ...|85.|..7     line 0
-// 382|...|...          1
-// 9.7|.3.|184          2
-// -----------          3
-// .28|..6|.3.          4
-// 4.9|...|8.1          5
-// .3.|9..|47.          6
-// -----------          7
-// 713|.6.|2.8          8
-// ...|...|516          9
-// 2..|.98|...         10
-void parse_ss_format(const char *contents, struct grid *into) {
-    const char *next_char = contents;
+static inline bool level_set_has(const struct level_set *set, u32 level) {
+    return (set->bits[level / 64] >> (level % 64)) & 1;
+}
+
+static inline void level_set_unite(struct level_set *into, const struct level_set *from) {
+    into->bits[0] |= from->bits[0];
+    into->bits[1] |= from->bits[1];
+}
+
+static inline u32 level_set_count(const struct level_set *set) {
+    return popcount32((u32) set->bits[0]) + popcount32((u32) (set->bits[0] >> 32)) +
+           popcount32((u32) set->bits[1]) + popcount32((u32) (set->bits[1] >> 32));
+}
+
+// a nogood is kept with the cell of its deepest guess, which is where it gets checked, the other
+// guesses are stored as cell and value pairs
+#define NOGOOD_MAX_OTHERS 7
+#define NOGOODS_PER_CELL 8
+
+struct nogood {
+    u8 value;
+    u8 n_others;
+    u8 other_cells[NOGOOD_MAX_OTHERS];
+    u8 other_values[NOGOOD_MAX_OTHERS];
+};
+
+#define NOT_A_LEVEL 0xFF
+
+struct backjump_state {
+    // the empty cells the search fills, in order, and the level of every cell (NOT_A_LEVEL for the others)
+    u8 level_cells[81];
+    u8 cell_levels[81];
+    u32 n_levels;
+    
+    // the candidates of every cell when the search started, a value outside them was ruled out
+    // by the givens or the logic passes, not by a guess
+    u16 start_candidates[81];
+    
+    // guess_levels[unit][i] is the level of the guess that put value i + 1 in the unit, NOT_A_LEVEL if
+    // no guess did, units numbered like in unit_cells
+    u8 guess_levels[27][9];
+    
+    // nogoods[cell] is a ring of the last NOGOODS_PER_CELL nogoods whose deepest guess is in cell
+    struct nogood nogoods[81][NOGOODS_PER_CELL];
+    u8 n_nogoods[81];
+    u8 next_nogood[81];
+};
+
+// the level of the earliest guess that placed value in a peer of cell_idx
+static inline u32 earliest_culprit(const struct backjump_state *backjump, u32 cell_idx, u32 value) {
+    u32 row_idx = cell_idx / 9;
+    u32 col_idx = cell_idx % 9;
+    
+    u32 culprit = backjump->guess_levels[row_idx][value - 1];
+    if (backjump->guess_levels[9 + col_idx][value - 1] < culprit)
+        culprit = backjump->guess_levels[9 + col_idx][value - 1];
+    if (backjump->guess_levels[18 + box_index_lookup[row_idx][col_idx]][value - 1] < culprit)
+        culprit = backjump->guess_levels[18 + box_index_lookup[row_idx][col_idx]][value - 1];
+    return culprit;
+}
+
+// records (or with level NOT_A_LEVEL, forgets) the guess of value at cell_idx in the units of the cell
+static inline void set_guess_level(struct backjump_state *backjump, u32 cell_idx, u32 value, u32 level) {
+    u32 row_idx = cell_idx / 9;
+    u32 col_idx = cell_idx % 9;
+    
+    backjump->guess_levels[row_idx][value - 1] = (u8) level;
+    backjump->guess_levels[9 + col_idx][value - 1] = (u8) level;
+    backjump->guess_levels[18 + box_index_lookup[row_idx][col_idx]][value - 1] = (u8) level;
+}
+
+// if putting value in cell_idx completes a nogood, adds the levels of its other guesses to conflicts
+static bool completes_nogood(const struct solve_state *solve_state, const struct backjump_state *backjump, u32 cell_idx, u32 value,
+                             struct level_set *conflicts) {
+    for (u32 i = 0; i < backjump->n_nogoods[cell_idx]; i++) {
+        const struct nogood *nogood = &backjump->nogoods[cell_idx][i];
+        if (nogood->value != value)
+            continue;
+        
+        u32 j = 0;
+        while (j < nogood->n_others) {
+            u32 other_idx = nogood->other_cells[j];
+            if (solve_state->values[other_idx / 9][other_idx % 9] != nogood->other_values[j])
+                break;
+            j++;
+        }
+        
+        if (j < nogood->n_others)
+            continue;
+        
+        for (j = 0; j < nogood->n_others; j++)
+            level_set_add(conflicts, backjump->cell_levels[nogood->other_cells[j]]);
+        STAT_ADD(nogood_hits, 1);
+        return true;
+    }
+    
+    return false;
+}
+
+// value at the cell of level and the guesses at the earlier levels in conflicts cannot all hold, keeps
+// them as a nogood of that cell if there are few enough
+static void learn_nogood(const struct solve_state *solve_state, struct backjump_state *backjump, u32 level, u32 value,
+                         const struct level_set *conflicts) {
+    if (level_set_count(conflicts) > NOGOOD_MAX_OTHERS + 1)
+        return;
+    
+    u32 cell_idx = backjump->level_cells[level];
+    
+    struct nogood *nogood = &backjump->nogoods[cell_idx][backjump->next_nogood[cell_idx]];
+    backjump->next_nogood[cell_idx] = (backjump->next_nogood[cell_idx] + 1) % NOGOODS_PER_CELL;
+    if (backjump->n_nogoods[cell_idx] < NOGOODS_PER_CELL)
+        backjump->n_nogoods[cell_idx]++;
+    
+    nogood->value = (u8) value;
+    nogood->n_others = 0;
+    for (u32 other_level = 0; other_level < level; other_level++) {
+        if (!level_set_has(conflicts, other_level))
+            continue;
+        
+        u32 other_idx = backjump->level_cells[other_level];
+        nogood->other_cells[nogood->n_others] = (u8) other_idx;
+        nogood->other_values[nogood->n_others] = (u8) solve_state->values[other_idx / 9][other_idx % 9];
+        nogood->n_others++;
+    }
+    STAT_ADD(nogoods_learned, 1);
+}
+
+// fills the cells from level on, returns true once the grid is filled out
+// otherwise conflicts gets the levels of the guesses that caused the failure, empty if the puzzle
+// has no solution at all, the budget ran out or it is time to restart
+bool backjump_search(struct solve_state *solve_state, struct backjump_state *backjump, struct search_control *control, u32 level,
+                     struct level_set *conflicts, struct sudoku_solve_stats *stats) {
+    conflicts->bits[0] = 0;
+    conflicts->bits[1] = 0;
+    
+    if (level == backjump->n_levels)
+        return true;
+    
+    u32 cell_idx = backjump->level_cells[level];
+    if (control->random_mrv) {
+        // a dead end is blamed below like any other cell that runs out of values
+        u32 n_candidates;
+        pick_random_mrv_cell(solve_state, control, &cell_idx, &n_candidates);
+        backjump->level_cells[level] = (u8) cell_idx;
+        backjump->cell_levels[cell_idx] = (u8) level;
+    }
+    
+    u32 row_idx = cell_idx / 9;
+    u32 col_idx = cell_idx % 9;
+    const s32 *collisions = solve_state->collisions[row_idx][col_idx];
+    
+    for (u16 candidates = backjump->start_candidates[cell_idx]; candidates; candidates &= candidates - 1) {
+        u32 value = ctz32(candidates) + 1;
+        
+        if (collisions[value - 1] > 0) {
+            u32 culprit = earliest_culprit(backjump, cell_idx, value);
+            assert(culprit < level);
+            level_set_add(conflicts, culprit);
+        }
+    }
+    
+    // the values without collisions, which are all among the start candidates
+    u8 values[9];
+    u32 n_values = ordered_candidates(solve_state, control, row_idx, col_idx, values);
+    
+    for (u32 i = 0; i < n_values; i++) {
+        u32 value = values[i];
+        
+        if (completes_nogood(solve_state, backjump, cell_idx, value, conflicts))
+            continue;
+        
+        if (out_of_budget(stats->nodes))
+            return false;
+        
+        if (stats->nodes >= control->restart_at) {
+            control->restarting = true;
+            return false;
+        }
+        
+        set_value(solve_state, row_idx, col_idx, value);
+        set_guess_level(backjump, cell_idx, value, level);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        struct level_set below;
+        if (backjump_search(solve_state, backjump, control, level + 1, &below, stats))
+            return true;
+        
+        unset_value(solve_state, row_idx, col_idx);
+        set_guess_level(backjump, cell_idx, value, NOT_A_LEVEL);
+        STAT_BACKTRACK();
+        
+        // the failure below is not a real one, nothing can be learned from it
+        if (active_budget.exhausted || control->restarting)
+            return false;
+        
+        // this guess had nothing to do with the failure below, so no other value can fix it either
+        if (!level_set_has(&below, level)) {
+            STAT_ADD(backjumps, 1);
+            *conflicts = below;
+            return false;
+        }
+        
+        learn_nogood(solve_state, backjump, level, value, &below);
+        
+        level_set_remove(&below, level);
+        level_set_unite(conflicts, &below);
+    }
+    
+    return false;
+}
+
+// numbers the empty cells of solve_state and takes their candidates, for a search from level 0
+void initialize_backjump_state(const struct solve_state *solve_state, struct backjump_state *backjump) {
+    candidate_masks(solve_state, backjump->start_candidates);
+    memset(backjump->guess_levels, NOT_A_LEVEL, sizeof(backjump->guess_levels));
+    
+    backjump->n_levels = 0;
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        backjump->n_nogoods[cell_idx] = 0;
+        backjump->next_nogood[cell_idx] = 0;
+        
+        if (solve_state->values[cell_idx / 9][cell_idx % 9] != 0) {
+            backjump->cell_levels[cell_idx] = NOT_A_LEVEL;
+            continue;
+        }
+        
+        backjump->cell_levels[cell_idx] = (u8) backjump->n_levels;
+        backjump->level_cells[backjump->n_levels++] = (u8) cell_idx;
+    }
+}
+
+#define DEFAULT_RESTART_NODES 100
+#define RESTART_GROWTH 1.5
+
+// the i-th term of the luby sequence 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8 ..., counting from 1
+static u64 luby(u64 i) {
+    for (;;) {
+        u32 k = 1;
+        while (((u64) 1 << k) - 1 < i)
+            k++;
+        
+        if (((u64) 1 << k) - 1 == i)
+            return (u64) 1 << (k - 1);
+        
+        // past the first 2^(k-1) - 1 terms the sequence repeats itself
+        i -= ((u64) 1 << (k - 1)) - 1;
+    }
+}
+
+// how many search nodes the search gets after n_restarts restarts before it restarts again
+static u64 restart_limit(const struct sudoku_solve_options *options, u64 n_restarts) {
+    u64 unit = options->restart_nodes ? options->restart_nodes : DEFAULT_RESTART_NODES;
+    
+    switch (options->restarts) {
+        case SUDOKU_RESTART_LUBY:
+            return unit * luby(n_restarts + 1);
+        
+        case SUDOKU_RESTART_GEOMETRIC: {
+            double limit = (double) unit;
+            for (u64 i = 0; i < n_restarts && limit < 1e18; i++)
+                limit *= RESTART_GROWTH;
+            return (u64) limit;
+        }
+        
+        default:
+            return UINT64_MAX;
+    }
+}
+
+// returns false if the puzzle has no solution, into is then left partially filled
+// solve_state is room for the engine's state, it does not need to be initialized, and so is backjump,
+// which is only used with options->backjump
+bool solve(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_state, struct sudoku_grid *into, struct solve_state *solve_state,
+           struct backjump_state *backjump, struct sudoku_solve_stats *stats) {
+    assert(initial_state);
+    assert(solve_state);
+    
+    if (has_conflicting_givens(initial_state)) {
+        memcpy(into->values, initial_state->values, sizeof(into->values));
+        return false;
+    }
+    
+    STAT_PHASE_START(setup_start);
+    
+    memcpy(solve_state->values, initial_state->values, sizeof(solve_state->values[0][0]) * 81);
+    
+    initialize_solve_state_collisions(solve_state);
+    
+    STAT_PHASE_END(setup_seconds, setup_start);
+    STAT_PHASE_START(logic_start);
+
+    // singles are propagated from what changed until there are none left, a subset (or a
+    // technique, once there are no subsets either) then queues the cells it took candidates from,
+    // which is all the singles look at next time
+    {
+        struct propagation_queue queue;
+        propagation_queue_init(solve_state, &queue);
+        
+        do {
+            propagate_singles(solve_state, &queue);
+        } while (reveal_subsets(solve_state, &queue) || reveal_techniques(solve_state, &queue, options->techniques));
+    }
+	
+	//char grid_str[GRID_STR_SIZE];
+	//printf("grid state after all passes: \n%s\n", solve_state_str(solve_state, grid_str));
+
+    STAT_PHASE_END(logic_seconds, logic_start);
+    STAT_PHASE_START(search_start);
+
+    struct search_control control;
+    control.order = options->value_order;
+    control.random_state = options->seed ^ 0x9E3779B97F4A7C15ULL;
+    if (control.random_state == 0)
+        control.random_state = 1;
+    control.random_mrv = options->mrv;
+    
+    if (options->backjump)
+        initialize_backjump_state(solve_state, backjump);
+    
+    // a search that stops to restart has taken back every guess, so the next one starts from the
+    // same state, with the random order and the mrv ties moved on and the nogoods kept
+    bool success;
+    u64 n_restarts = 0;
+    for (;;) {
+        u64 limit = restart_limit(options, n_restarts);
+        control.restart_at = limit < UINT64_MAX - stats->nodes ? stats->nodes + limit : UINT64_MAX;
+        control.restarting = false;
+        
+        if (options->backjump) {
+            struct level_set conflicts;
+            success = backjump_search(solve_state, backjump, &control, 0, &conflicts, stats);
+        } else if (control.random_mrv) {
+            success = random_mrv_solve(solve_state, &control, stats);
+        } else {
+            success = recursive_solve(solve_state, &control, 0, 0, stats);
+        }
+        
+        if (!control.restarting)
+            break;
+        n_restarts++;
+    }
+    
+    stats->restarts += n_restarts;
+    if (n_restarts > stats->max_restarts)
+        stats->max_restarts = n_restarts;
+
+    STAT_PHASE_END(search_seconds, search_start);
+
+    memcpy(into->values, solve_state->values, 81 * sizeof(into->values[0][0]));
+    
+    return success;
+}
+
+// ---------------------------------------------------------------------------
+// bitmask engine
+//
+// same techniques as the collisions engine above, but the candidates of a cell are
+// kept as a 9 bit mask (bit i set => value i + 1 is allowed) instead of 9 counters
+// a value placed in a row/col/box is recorded in that unit's "used" mask, so setting
+// or unsetting a value is 3 ORs/ANDs instead of 27 counter updates
+// the candidates of an empty cell are its own mask minus whatever its row, col & box already use
+// ---------------------------------------------------------------------------
+
+// unit_cells[unit] are the cell indices (row * 9 + col) of a unit
+// units 0-8 are rows, 9-17 are columns and 18-26 are boxes
+const u8 unit_cells[27][9] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8},
+    { 9, 10, 11, 12, 13, 14, 15, 16, 17},
+    {18, 19, 20, 21, 22, 23, 24, 25, 26},
+    {27, 28, 29, 30, 31, 32, 33, 34, 35},
+    {36, 37, 38, 39, 40, 41, 42, 43, 44},
+    {45, 46, 47, 48, 49, 50, 51, 52, 53},
+    {54, 55, 56, 57, 58, 59, 60, 61, 62},
+    {63, 64, 65, 66, 67, 68, 69, 70, 71},
+    {72, 73, 74, 75, 76, 77, 78, 79, 80},
+    { 0,  9, 18, 27, 36, 45, 54, 63, 72},
+    { 1, 10, 19, 28, 37, 46, 55, 64, 73},
+    { 2, 11, 20, 29, 38, 47, 56, 65, 74},
+    { 3, 12, 21, 30, 39, 48, 57, 66, 75},
+    { 4, 13, 22, 31, 40, 49, 58, 67, 76},
+    { 5, 14, 23, 32, 41, 50, 59, 68, 77},
+    { 6, 15, 24, 33, 42, 51, 60, 69, 78},
+    { 7, 16, 25, 34, 43, 52, 61, 70, 79},
+    { 8, 17, 26, 35, 44, 53, 62, 71, 80},
+    { 0,  1,  2,  9, 10, 11, 18, 19, 20},
+    { 3,  4,  5, 12, 13, 14, 21, 22, 23},
+    { 6,  7,  8, 15, 16, 17, 24, 25, 26},
+    {27, 28, 29, 36, 37, 38, 45, 46, 47},
+    {30, 31, 32, 39, 40, 41, 48, 49, 50},
+    {33, 34, 35, 42, 43, 44, 51, 52, 53},
+    {54, 55, 56, 63, 64, 65, 72, 73, 74},
+    {57, 58, 59, 66, 67, 68, 75, 76, 77},
+    {60, 61, 62, 69, 70, 71, 78, 79, 80},
+};
+
+const u8 cell_row_lookup[81] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7,
+    8, 8, 8, 8, 8, 8, 8, 8, 8,
+};
+
+const u8 cell_col_lookup[81] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8,
+};
+
+const u8 cell_box_lookup[81] = {
+    0, 0, 0, 1, 1, 1, 2, 2, 2,
+    0, 0, 0, 1, 1, 1, 2, 2, 2,
+    0, 0, 0, 1, 1, 1, 2, 2, 2,
+    3, 3, 3, 4, 4, 4, 5, 5, 5,
+    3, 3, 3, 4, 4, 4, 5, 5, 5,
+    3, 3, 3, 4, 4, 4, 5, 5, 5,
+    6, 6, 6, 7, 7, 7, 8, 8, 8,
+    6, 6, 6, 7, 7, 7, 8, 8, 8,
+    6, 6, 6, 7, 7, 7, 8, 8, 8,
+};
+
+// 81 + 162 + 54 bytes, the whole state is 5 cache lines
+struct bitmask_state {
+    u8 values[81];
+    
+    // candidates[cell] is the set of values the cell may still take
+    // it only shrinks through eliminations (naked pairs and the techniques), placements are tracked by the used masks
+    u16 candidates[81];
+    
+    // bit i is set if value i + 1 is already placed in that row/col/box
+    u16 row_used[9];
+    u16 col_used[9];
+    u16 box_used[9];
+};
+
+// the values that can currently be placed in empty cell cell_idx
+static inline u16 bitmask_cell_candidates(const struct bitmask_state *state, u32 cell_idx) {
+    u16 used = state->row_used[cell_row_lookup[cell_idx]] | state->col_used[cell_col_lookup[cell_idx]] | state->box_used[cell_box_lookup[cell_idx]];
+    return state->candidates[cell_idx] & ~used;
+}
+
+void bitmask_set_value(struct bitmask_state *state, u32 cell_idx, u32 value) {
+    assert(state);
+    assert(cell_idx < 81);
+    assert(value >= 1);
+    assert(value <= 9);
+    assert(state->values[cell_idx] == 0);
+    
+    u16 bit = (u16) (1 << (value - 1));
+    
+    state->values[cell_idx] = (u8) value;
+    STAT_ADD(set_value_calls, 1);
+    state->row_used[cell_row_lookup[cell_idx]] |= bit;
+    state->col_used[cell_col_lookup[cell_idx]] |= bit;
+    state->box_used[cell_box_lookup[cell_idx]] |= bit;
+}
+
+void bitmask_unset_value(struct bitmask_state *state, u32 cell_idx) {
+    assert(state);
+    assert(cell_idx < 81);
+    assert(state->values[cell_idx] != 0);
+    
+    u16 bit = (u16) (1 << (state->values[cell_idx] - 1));
+    
+    state->values[cell_idx] = 0;
+    STAT_ADD(unset_value_calls, 1);
+    state->row_used[cell_row_lookup[cell_idx]] &= ~bit;
+    state->col_used[cell_col_lookup[cell_idx]] &= ~bit;
+    state->box_used[cell_box_lookup[cell_idx]] &= ~bit;
+}
+
+// returns false if two givens share a value in a row, col or box
+bool initialize_bitmask_state(struct bitmask_state *state, const struct sudoku_grid *initial_state) {
+    assert(state);
+    assert(initial_state);
+    
+    memset(state, 0, sizeof(*state));
+    
+    bool consistent = true;
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        state->candidates[cell_idx] = ALL_CANDIDATES;
+        
+        u32 value = initial_state->values[cell_idx / 9][cell_idx % 9];
+        if (value == 0)
+            continue;
+        
+        if (!(bitmask_cell_candidates(state, cell_idx) & (1 << (value - 1)))) {
+            // keep the value so the partial state still shows the givens
+            state->values[cell_idx] = (u8) value;
+            consistent = false;
+            continue;
+        }
+        
+        bitmask_set_value(state, cell_idx, value);
+    }
+    
+    return consistent;
+}
+
+bool bitmask_recursive_solve(struct bitmask_state *state, u32 cell_idx, struct sudoku_solve_stats *stats) {
+    // skip over the cells that are already filled
+    while (cell_idx < 81 && state->values[cell_idx] != 0)
+        cell_idx++;
+    
+    // if we've gone off the end of the grid, that means we have solved it
+    if (cell_idx == 81)
+        return true;
+    
+    u32 candidates = bitmask_cell_candidates(state, cell_idx);
+    
+    // try the candidates from lowest to highest, same order as the collisions engine
+    while (candidates) {
+        if (out_of_budget(stats->nodes))
+            return false;
+        
+        u32 value = ctz32(candidates) + 1;
+        candidates &= candidates - 1;
+        
+        bitmask_set_value(state, cell_idx, value);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (bitmask_recursive_solve(state, cell_idx + 1, stats))
+            return true;
+        
+        bitmask_unset_value(state, cell_idx);
+        STAT_BACKTRACK();
+    }
+    
+    return false;
+}
+
+// peer_cells[cell] are the 20 other cells sharing a row, col or box with cell
+const u8 peer_cells[81][20] = {
+    { 1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 18, 19, 20, 27, 36, 45, 54, 63, 72},
+    { 0,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 18, 19, 20, 28, 37, 46, 55, 64, 73},
+    { 0,  1,  3,  4,  5,  6,  7,  8,  9, 10, 11, 18, 19, 20, 29, 38, 47, 56, 65, 74},
+    { 0,  1,  2,  4,  5,  6,  7,  8, 12, 13, 14, 21, 22, 23, 30, 39, 48, 57, 66, 75},
+    { 0,  1,  2,  3,  5,  6,  7,  8, 12, 13, 14, 21, 22, 23, 31, 40, 49, 58, 67, 76},
+    { 0,  1,  2,  3,  4,  6,  7,  8, 12, 13, 14, 21, 22, 23, 32, 41, 50, 59, 68, 77},
+    { 0,  1,  2,  3,  4,  5,  7,  8, 15, 16, 17, 24, 25, 26, 33, 42, 51, 60, 69, 78},
+    { 0,  1,  2,  3,  4,  5,  6,  8, 15, 16, 17, 24, 25, 26, 34, 43, 52, 61, 70, 79},
+    { 0,  1,  2,  3,  4,  5,  6,  7, 15, 16, 17, 24, 25, 26, 35, 44, 53, 62, 71, 80},
+    { 0,  1,  2, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 27, 36, 45, 54, 63, 72},
+    { 0,  1,  2,  9, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 28, 37, 46, 55, 64, 73},
+    { 0,  1,  2,  9, 10, 12, 13, 14, 15, 16, 17, 18, 19, 20, 29, 38, 47, 56, 65, 74},
+    { 3,  4,  5,  9, 10, 11, 13, 14, 15, 16, 17, 21, 22, 23, 30, 39, 48, 57, 66, 75},
+    { 3,  4,  5,  9, 10, 11, 12, 14, 15, 16, 17, 21, 22, 23, 31, 40, 49, 58, 67, 76},
+    { 3,  4,  5,  9, 10, 11, 12, 13, 15, 16, 17, 21, 22, 23, 32, 41, 50, 59, 68, 77},
+    { 6,  7,  8,  9, 10, 11, 12, 13, 14, 16, 17, 24, 25, 26, 33, 42, 51, 60, 69, 78},
+    { 6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 17, 24, 25, 26, 34, 43, 52, 61, 70, 79},
+    { 6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 24, 25, 26, 35, 44, 53, 62, 71, 80},
+    { 0,  1,  2,  9, 10, 11, 19, 20, 21, 22, 23, 24, 25, 26, 27, 36, 45, 54, 63, 72},
+    { 0,  1,  2,  9, 10, 11, 18, 20, 21, 22, 23, 24, 25, 26, 28, 37, 46, 55, 64, 73},
+    { 0,  1,  2,  9, 10, 11, 18, 19, 21, 22, 23, 24, 25, 26, 29, 38, 47, 56, 65, 74},
+    { 3,  4,  5, 12, 13, 14, 18, 19, 20, 22, 23, 24, 25, 26, 30, 39, 48, 57, 66, 75},
+    { 3,  4,  5, 12, 13, 14, 18, 19, 20, 21, 23, 24, 25, 26, 31, 40, 49, 58, 67, 76},
+    { 3,  4,  5, 12, 13, 14, 18, 19, 20, 21, 22, 24, 25, 26, 32, 41, 50, 59, 68, 77},
+    { 6,  7,  8, 15, 16, 17, 18, 19, 20, 21, 22, 23, 25, 26, 33, 42, 51, 60, 69, 78},
+    { 6,  7,  8, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 26, 34, 43, 52, 61, 70, 79},
+    { 6,  7,  8, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 35, 44, 53, 62, 71, 80},
+    { 0,  9, 18, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 45, 46, 47, 54, 63, 72},
+    { 1, 10, 19, 27, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 45, 46, 47, 55, 64, 73},
+    { 2, 11, 20, 27, 28, 30, 31, 32, 33, 34, 35, 36, 37, 38, 45, 46, 47, 56, 65, 74},
+    { 3, 12, 21, 27, 28, 29, 31, 32, 33, 34, 35, 39, 40, 41, 48, 49, 50, 57, 66, 75},
+    { 4, 13, 22, 27, 28, 29, 30, 32, 33, 34, 35, 39, 40, 41, 48, 49, 50, 58, 67, 76},
+    { 5, 14, 23, 27, 28, 29, 30, 31, 33, 34, 35, 39, 40, 41, 48, 49, 50, 59, 68, 77},
+    { 6, 15, 24, 27, 28, 29, 30, 31, 32, 34, 35, 42, 43, 44, 51, 52, 53, 60, 69, 78},
+    { 7, 16, 25, 27, 28, 29, 30, 31, 32, 33, 35, 42, 43, 44, 51, 52, 53, 61, 70, 79},
+    { 8, 17, 26, 27, 28, 29, 30, 31, 32, 33, 34, 42, 43, 44, 51, 52, 53, 62, 71, 80},
+    { 0,  9, 18, 27, 28, 29, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 54, 63, 72},
+    { 1, 10, 19, 27, 28, 29, 36, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 55, 64, 73},
+    { 2, 11, 20, 27, 28, 29, 36, 37, 39, 40, 41, 42, 43, 44, 45, 46, 47, 56, 65, 74},
+    { 3, 12, 21, 30, 31, 32, 36, 37, 38, 40, 41, 42, 43, 44, 48, 49, 50, 57, 66, 75},
+    { 4, 13, 22, 30, 31, 32, 36, 37, 38, 39, 41, 42, 43, 44, 48, 49, 50, 58, 67, 76},
+    { 5, 14, 23, 30, 31, 32, 36, 37, 38, 39, 40, 42, 43, 44, 48, 49, 50, 59, 68, 77},
+    { 6, 15, 24, 33, 34, 35, 36, 37, 38, 39, 40, 41, 43, 44, 51, 52, 53, 60, 69, 78},
+    { 7, 16, 25, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 44, 51, 52, 53, 61, 70, 79},
+    { 8, 17, 26, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 51, 52, 53, 62, 71, 80},
+    { 0,  9, 18, 27, 28, 29, 36, 37, 38, 46, 47, 48, 49, 50, 51, 52, 53, 54, 63, 72},
+    { 1, 10, 19, 27, 28, 29, 36, 37, 38, 45, 47, 48, 49, 50, 51, 52, 53, 55, 64, 73},
+    { 2, 11, 20, 27, 28, 29, 36, 37, 38, 45, 46, 48, 49, 50, 51, 52, 53, 56, 65, 74},
+    { 3, 12, 21, 30, 31, 32, 39, 40, 41, 45, 46, 47, 49, 50, 51, 52, 53, 57, 66, 75},
+    { 4, 13, 22, 30, 31, 32, 39, 40, 41, 45, 46, 47, 48, 50, 51, 52, 53, 58, 67, 76},
+    { 5, 14, 23, 30, 31, 32, 39, 40, 41, 45, 46, 47, 48, 49, 51, 52, 53, 59, 68, 77},
+    { 6, 15, 24, 33, 34, 35, 42, 43, 44, 45, 46, 47, 48, 49, 50, 52, 53, 60, 69, 78},
+    { 7, 16, 25, 33, 34, 35, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 53, 61, 70, 79},
+    { 8, 17, 26, 33, 34, 35, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 62, 71, 80},
+    { 0,  9, 18, 27, 36, 45, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 72, 73, 74},
+    { 1, 10, 19, 28, 37, 46, 54, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 72, 73, 74},
+    { 2, 11, 20, 29, 38, 47, 54, 55, 57, 58, 59, 60, 61, 62, 63, 64, 65, 72, 73, 74},
+    { 3, 12, 21, 30, 39, 48, 54, 55, 56, 58, 59, 60, 61, 62, 66, 67, 68, 75, 76, 77},
+    { 4, 13, 22, 31, 40, 49, 54, 55, 56, 57, 59, 60, 61, 62, 66, 67, 68, 75, 76, 77},
+    { 5, 14, 23, 32, 41, 50, 54, 55, 56, 57, 58, 60, 61, 62, 66, 67, 68, 75, 76, 77},
+    { 6, 15, 24, 33, 42, 51, 54, 55, 56, 57, 58, 59, 61, 62, 69, 70, 71, 78, 79, 80},
+    { 7, 16, 25, 34, 43, 52, 54, 55, 56, 57, 58, 59, 60, 62, 69, 70, 71, 78, 79, 80},
+    { 8, 17, 26, 35, 44, 53, 54, 55, 56, 57, 58, 59, 60, 61, 69, 70, 71, 78, 79, 80},
+    { 0,  9, 18, 27, 36, 45, 54, 55, 56, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74},
+    { 1, 10, 19, 28, 37, 46, 54, 55, 56, 63, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74},
+    { 2, 11, 20, 29, 38, 47, 54, 55, 56, 63, 64, 66, 67, 68, 69, 70, 71, 72, 73, 74},
+    { 3, 12, 21, 30, 39, 48, 57, 58, 59, 63, 64, 65, 67, 68, 69, 70, 71, 75, 76, 77},
+    { 4, 13, 22, 31, 40, 49, 57, 58, 59, 63, 64, 65, 66, 68, 69, 70, 71, 75, 76, 77},
+    { 5, 14, 23, 32, 41, 50, 57, 58, 59, 63, 64, 65, 66, 67, 69, 70, 71, 75, 76, 77},
+    { 6, 15, 24, 33, 42, 51, 60, 61, 62, 63, 64, 65, 66, 67, 68, 70, 71, 78, 79, 80},
+    { 7, 16, 25, 34, 43, 52, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 71, 78, 79, 80},
+    { 8, 17, 26, 35, 44, 53, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 78, 79, 80},
+    { 0,  9, 18, 27, 36, 45, 54, 55, 56, 63, 64, 65, 73, 74, 75, 76, 77, 78, 79, 80},
+    { 1, 10, 19, 28, 37, 46, 54, 55, 56, 63, 64, 65, 72, 74, 75, 76, 77, 78, 79, 80},
+    { 2, 11, 20, 29, 38, 47, 54, 55, 56, 63, 64, 65, 72, 73, 75, 76, 77, 78, 79, 80},
+    { 3, 12, 21, 30, 39, 48, 57, 58, 59, 66, 67, 68, 72, 73, 74, 76, 77, 78, 79, 80},
+    { 4, 13, 22, 31, 40, 49, 57, 58, 59, 66, 67, 68, 72, 73, 74, 75, 77, 78, 79, 80},
+    { 5, 14, 23, 32, 41, 50, 57, 58, 59, 66, 67, 68, 72, 73, 74, 75, 76, 78, 79, 80},
+    { 6, 15, 24, 33, 42, 51, 60, 61, 62, 69, 70, 71, 72, 73, 74, 75, 76, 77, 79, 80},
+    { 7, 16, 25, 34, 43, 52, 60, 61, 62, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 80},
+    { 8, 17, 26, 35, 44, 53, 60, 61, 62, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79},
+};
+
+// keeps every empty cell in a bucket by its number of candidates so the search can
+// pick the most constrained cell without scanning the whole grid
+// placing a value only moves the peers that lose that value down one bucket
+struct mrv_index {
+    // candidates of every empty cell as of the last update
+    u16 cell_candidates[81];
+    
+    // candidate_count[cell] is the bucket the cell is in, MRV_NOT_INDEXED for filled cells
+    u8 candidate_count[81];
+    
+    // cells_with_count[n] is the set of empty cells with n candidates, cell i is bit i % 64 of word i / 64
+    u64 cells_with_count[10][2];
+};
+
+#define MRV_NOT_INDEXED 0xFF
+
+// moves cell_idx into bucket new_count, MRV_NOT_INDEXED takes it out of the index
+static inline void mrv_index_move_cell(struct mrv_index *index, u32 cell_idx, u32 new_count) {
+    u32 old_count = index->candidate_count[cell_idx];
+    u64 bit = (u64) 1 << (cell_idx % 64);
+    
+    if (old_count != MRV_NOT_INDEXED)
+        index->cells_with_count[old_count][cell_idx / 64] &= ~bit;
+    if (new_count != MRV_NOT_INDEXED)
+        index->cells_with_count[new_count][cell_idx / 64] |= bit;
+    
+    index->candidate_count[cell_idx] = (u8) new_count;
+}
+
+void initialize_mrv_index(struct mrv_index *index, const struct bitmask_state *state) {
+    memset(index->cells_with_count, 0, sizeof(index->cells_with_count));
+    memset(index->candidate_count, MRV_NOT_INDEXED, sizeof(index->candidate_count));
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        if (state->values[cell_idx] != 0)
+            continue;
+        
+        index->cell_candidates[cell_idx] = bitmask_cell_candidates(state, cell_idx);
+        mrv_index_move_cell(index, cell_idx, popcount16(index->cell_candidates[cell_idx]));
+    }
+}
+
+// must be called after value has been set at cell_idx
+// the peers that had value as a candidate are written to removed_from (at most 20) so the
+// placement can be undone with mrv_index_unplace, returns how many there were
+u32 mrv_index_place(struct mrv_index *index, u32 cell_idx, u32 value, u8 *removed_from) {
+    u16 bit = (u16) (1 << (value - 1));
+    u32 n_removed = 0;
+    
+    mrv_index_move_cell(index, cell_idx, MRV_NOT_INDEXED);
+    
+    const u8 *peers = peer_cells[cell_idx];
+    for (u32 i = 0; i < 20; i++) {
+        u32 peer_idx = peers[i];
+        
+        if (index->candidate_count[peer_idx] == MRV_NOT_INDEXED || !(index->cell_candidates[peer_idx] & bit))
+            continue;
+        
+        index->cell_candidates[peer_idx] &= ~bit;
+        mrv_index_move_cell(index, peer_idx, index->candidate_count[peer_idx] - 1);
+        removed_from[n_removed++] = (u8) peer_idx;
+    }
+    
+    return n_removed;
+}
+
+// reverts a mrv_index_place, the value must already be unset from cell_idx
+void mrv_index_unplace(struct mrv_index *index, u32 cell_idx, u32 value, const u8 *removed_from, u32 n_removed) {
+    u16 bit = (u16) (1 << (value - 1));
+    
+    for (u32 i = 0; i < n_removed; i++) {
+        u32 peer_idx = removed_from[i];
+        index->cell_candidates[peer_idx] |= bit;
+        mrv_index_move_cell(index, peer_idx, index->candidate_count[peer_idx] + 1);
+    }
+    
+    mrv_index_move_cell(index, cell_idx, popcount16(index->cell_candidates[cell_idx]));
+}
+
+// finds the empty cell with the fewest candidates, returns false if there are no empty cells
+// a cell with 0 candidates is returned first, so the search fails on it right away
+bool mrv_index_pick_cell(const struct mrv_index *index, u32 *cell_idx) {
+    for (u32 count = 0; count < 10; count++) {
+        const u64 *cells = index->cells_with_count[count];
+        if (cells[0]) {
+            *cell_idx = ctz64(cells[0]);
+            return true;
+        }
+        if (cells[1]) {
+            *cell_idx = 64 + ctz64(cells[1]);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool bitmask_mrv_recursive_solve(struct bitmask_state *state, struct mrv_index *index, struct sudoku_solve_stats *stats) {
+    u32 cell_idx;
+    
+    // no empty cells left, that means we have solved it
+    if (!mrv_index_pick_cell(index, &cell_idx))
+        return true;
+    
+    u32 candidates = index->cell_candidates[cell_idx];
+    
+    while (candidates) {
+        if (out_of_budget(stats->nodes))
+            return false;
+        
+        u32 value = ctz32(candidates) + 1;
+        candidates &= candidates - 1;
+        
+        u8 removed_from[20];
+        
+        bitmask_set_value(state, cell_idx, value);
+        u32 n_removed = mrv_index_place(index, cell_idx, value, removed_from);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (bitmask_mrv_recursive_solve(state, index, stats))
+            return true;
+        
+        bitmask_unset_value(state, cell_idx);
+        mrv_index_unplace(index, cell_idx, value, removed_from, n_removed);
+        STAT_BACKTRACK();
+    }
+    
+    return false;
+}
+
+// one level of the iterative search, the guess stack holds one per placed cell so it never
+// needs more than 81 of them
+struct search_frame {
+    u8 cell_idx;
+    
+    // candidates of cell_idx that have not been tried yet
+    u16 untried;
+    
+    // peers that lost the guessed value in the mrv index, only used with mrv
+    u8 n_removed;
+    u8 removed_from[20];
+};
+
+// same search as bitmask_recursive_solve (or bitmask_mrv_recursive_solve if index is not NULL)
+// but without recursion, the guess stack doubles as the trail of placed cells so
+// undoing a guess is just unsetting the cell on top of the stack
+// always inlined so that each caller gets a copy without the index checks in the loop
+static inline bool iterative_search(struct bitmask_state *state, struct mrv_index *index, struct sudoku_solve_stats *stats) {
+    struct search_frame stack[81];
+    u32 depth = 0;
+    u64 nodes = 0;
+    
+    // without mrv the cells are guessed in row-major order, so the cell of every depth is known up front
+    u8 empty_cells[81];
+    u32 n_empty = 0;
+    for (u32 i = 0; i < 81; i++)
+        if (state->values[i] == 0)
+            empty_cells[n_empty++] = (u8) i;
+    
+    u32 cell_idx;
+    if (index) {
+        if (!mrv_index_pick_cell(index, &cell_idx))
+            return true;
+    } else {
+        if (n_empty == 0)
+            return true;
+        cell_idx = empty_cells[0];
+    }
+    
+    stack[0].cell_idx = (u8) cell_idx;
+    stack[0].untried = index ? index->cell_candidates[cell_idx] : bitmask_cell_candidates(state, cell_idx);
+    
+    for (;;) {
+        struct search_frame *frame = &stack[depth];
+        
+        if (frame->untried == 0) {
+            // every value failed for this cell, go back to the previous guess
+            if (depth == 0) {
+                stats->nodes += nodes;
+                return false;
+            }
+            
+            depth--;
+            frame = &stack[depth];
+            
+            u32 value = state->values[frame->cell_idx];
+            bitmask_unset_value(state, frame->cell_idx);
+            if (index)
+                mrv_index_unplace(index, frame->cell_idx, value, frame->removed_from, frame->n_removed);
+            STAT_BACKTRACK();
+            
+            continue;
+        }
+        
+        if (out_of_budget(stats->nodes + nodes)) {
+            // undo the guesses so the partial state is only what the logic passes placed
+            for (u32 i = depth; i-- > 0;)
+                bitmask_unset_value(state, stack[i].cell_idx);
+            stats->nodes += nodes;
+            return false;
+        }
+        
+        u32 value = ctz32(frame->untried) + 1;
+        frame->untried &= frame->untried - 1;
+        
+        bitmask_set_value(state, frame->cell_idx, value);
+        if (index)
+            frame->n_removed = (u8) mrv_index_place(index, frame->cell_idx, value, frame->removed_from);
+        nodes++;
+        STAT_ENTER_GUESS();
+        
+        bool filled_out;
+        if (index)
+            filled_out = !mrv_index_pick_cell(index, &cell_idx);
+        else
+            filled_out = depth + 1 == n_empty;
+        
+        if (filled_out) {
+            stats->nodes += nodes;
+            return true;
+        }
+        
+        if (!index)
+            cell_idx = empty_cells[depth + 1];
+        
+        depth++;
+        stack[depth].cell_idx = (u8) cell_idx;
+        stack[depth].untried = index ? index->cell_candidates[cell_idx] : bitmask_cell_candidates(state, cell_idx);
+    }
+}
+
+bool bitmask_iterative_solve(struct bitmask_state *state, struct sudoku_solve_stats *stats) {
+    return iterative_search(state, NULL, stats);
+}
+
+bool bitmask_mrv_iterative_solve(struct bitmask_state *state, struct mrv_index *index, struct sudoku_solve_stats *stats) {
+    assert(index);
+    return iterative_search(state, index, stats);
+}
+
+// bitmask version of reveal_lone_singles
+bool bitmask_reveal_lone_singles(struct bitmask_state *state) {
+    bool revealed_at_least_one_in_loop;
+    bool revealed_at_least_one_overall = false;
+    
+    do {
+        revealed_at_least_one_in_loop = false;
+        
+        for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+            if (state->values[cell_idx] != 0)
+                continue;
+            
+            u16 candidates = bitmask_cell_candidates(state, cell_idx);
+            if (popcount16(candidates) != 1)
+                continue;
+            
+            bitmask_set_value(state, cell_idx, ctz32(candidates) + 1);
+            STAT_ADD(lone_singles, 1);
+            revealed_at_least_one_in_loop = true;
+        }
+        
+        if (revealed_at_least_one_in_loop)
+            revealed_at_least_one_overall = true;
+        
+    } while (revealed_at_least_one_in_loop);
+    
+    return revealed_at_least_one_overall;
+}
+
+// bitmask version of reveal_hidden_singles
+// for each unit we accumulate the values seen in at least one cell and in at least two cells,
+// the values seen exactly once are the hidden singles
+bool bitmask_reveal_hidden_singles(struct bitmask_state *state) {
+    bool revealed_at_least_one_in_loop;
+    bool revealed_at_least_one_overall = false;
+    
+    do {
+        revealed_at_least_one_in_loop = false;
+        
+        for (u32 unit_idx = 0; unit_idx < 27; unit_idx++) {
+            const u8 *cells = unit_cells[unit_idx];
+            
+            u16 seen_once = 0;
+            u16 seen_twice = 0;
+            for (u32 i = 0; i < 9; i++) {
+                if (state->values[cells[i]] != 0)
+                    continue;
+                
+                u16 candidates = bitmask_cell_candidates(state, cells[i]);
+                seen_twice |= seen_once & candidates;
+                seen_once |= candidates;
+            }
+            
+            u16 hidden_singles = seen_once & ~seen_twice;
+            
+            while (hidden_singles) {
+                u32 value_idx = ctz32(hidden_singles);
+                hidden_singles &= hidden_singles - 1;
+                
+                // find the cell into which we will place the value, it may have been taken by
+                // a previous hidden single of this unit if the state is contradictory
+                for (u32 i = 0; i < 9; i++) {
+                    u32 cell_idx = cells[i];
+                    if (state->values[cell_idx] == 0 && (bitmask_cell_candidates(state, cell_idx) & (1 << value_idx))) {
+                        bitmask_set_value(state, cell_idx, value_idx + 1);
+                        STAT_ADD(hidden_singles, 1);
+                        revealed_at_least_one_in_loop = true;
+                        break;
+                    }
+                }
+            }
+        }
+        
+        if (revealed_at_least_one_in_loop)
+            revealed_at_least_one_overall = true;
+        
+    } while (revealed_at_least_one_in_loop);
+    
+    return revealed_at_least_one_overall;
+}
+
+// bitmask version of reveal_naked_pairs
+// two cells of a unit with the same 2 candidates remove those candidates from the rest of the unit
+bool bitmask_reveal_naked_pairs(struct bitmask_state *state) {
+    bool found_naked_pair_last_iter;
+    bool found_naked_pair_overall = false;
+    
+    do {
+        found_naked_pair_last_iter = false;
+        
+        for (u32 unit_idx = 0; unit_idx < 27; unit_idx++) {
+            const u8 *cells = unit_cells[unit_idx];
+            
+            u16 unit_candidates[9];
+            for (u32 i = 0; i < 9; i++) {
+                if (state->values[cells[i]] == 0)
+                    unit_candidates[i] = bitmask_cell_candidates(state, cells[i]);
+                else
+                    unit_candidates[i] = 0;
+            }
+            
+            for (u32 i = 0; i < 9; i++) {
+                u16 pair = unit_candidates[i];
+                if (popcount16(pair) != 2)
+                    continue;
+                
+                for (u32 j = i + 1; j < 9; j++) {
+                    if (unit_candidates[j] != pair)
+                        continue;
+                    
+                    for (u32 k = 0; k < 9; k++) {
+                        if (k == i || k == j)
+                            continue;
+                        
+                        if (unit_candidates[k] & pair) {
+                            STAT_ADD(naked_pair_eliminations, popcount16(unit_candidates[k] & pair));
+                            state->candidates[cells[k]] &= ~pair;
+                            unit_candidates[k] &= ~pair;
+                            found_naked_pair_last_iter = true;
+                        }
+                    }
+                }
+            }
+        }
+        
+        if (found_naked_pair_last_iter)
+            found_naked_pair_overall = true;
+        
+    } while (found_naked_pair_last_iter);
+    
+    return found_naked_pair_overall;
+}
+
+// ---------------------------------------------------------------------------
+// propagating search
+//
+// unlike bitmask_recursive_solve, which only propagates once before the search, this runs
+// singles (and optionally naked pairs) after every guess and gives up on a guess as soon as
+// the state is contradictory
+// the state is small enough that each guess works on a copy, so backtracking rolls back
+// every deduction made below it by simply dropping the copy
+// ---------------------------------------------------------------------------
+
+// places lone and hidden singles until there are none left
+// returns false if the state is contradictory: an empty cell with no candidates or a value
+// that has no cell left in some unit
+bool bitmask_propagate_singles(struct bitmask_state *state) {
+    bool revealed_at_least_one;
+    
+    do {
+        revealed_at_least_one = false;
+        
+        for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+            if (state->values[cell_idx] != 0)
+                continue;
+            
+            u16 candidates = bitmask_cell_candidates(state, cell_idx);
+            if (candidates == 0)
+                return false;
+            
+            if (candidates & (candidates - 1))
+                continue;
+            
+            bitmask_set_value(state, cell_idx, ctz32(candidates) + 1);
+            STAT_ADD(lone_singles, 1);
+            revealed_at_least_one = true;
+        }
+        
+        for (u32 unit_idx = 0; unit_idx < 27; unit_idx++) {
+            const u8 *cells = unit_cells[unit_idx];
+            
+            u16 placed = 0;
+            u16 seen_once = 0;
+            u16 seen_twice = 0;
+            for (u32 i = 0; i < 9; i++) {
+                u32 value = state->values[cells[i]];
+                if (value != 0) {
+                    placed |= 1 << (value - 1);
+                    continue;
+                }
+                
+                u16 candidates = bitmask_cell_candidates(state, cells[i]);
+                seen_twice |= seen_once & candidates;
+                seen_once |= candidates;
+            }
+            
+            if ((placed | seen_once) != ALL_CANDIDATES)
+                return false;
+            
+            u16 hidden_singles = seen_once & ~seen_twice;
+            
+            while (hidden_singles) {
+                u32 value_idx = ctz32(hidden_singles);
+                hidden_singles &= hidden_singles - 1;
+                
+                u32 i;
+                for (i = 0; i < 9; i++) {
+                    u32 cell_idx = cells[i];
+                    if (state->values[cell_idx] == 0 && (bitmask_cell_candidates(state, cell_idx) & (1 << value_idx))) {
+                        bitmask_set_value(state, cell_idx, value_idx + 1);
+                        STAT_ADD(hidden_singles, 1);
+                        revealed_at_least_one = true;
+                        break;
+                    }
+                }
+                
+                // the only cell for this value was taken by another hidden single
+                if (i == 9)
+                    return false;
+            }
+        }
+    } while (revealed_at_least_one);
+    
+    return true;
+}
+
+// takes out of the candidates what the first fruitful technique turned on in techniques finds,
+// returns false if none of them found anything
+bool bitmask_reveal_techniques(struct bitmask_state *state, u32 techniques) {
+    if (techniques == 0)
+        return false;
+    
+    u16 masks[81];
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        masks[cell_idx] = state->values[cell_idx] == 0 ? bitmask_cell_candidates(state, cell_idx) : 0;
+    
+    u16 removed[81];
+    if (!find_technique_eliminations(techniques, masks, removed))
+        return false;
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        state->candidates[cell_idx] &= (u16) ~removed[cell_idx];
+    return true;
+}
+
+// runs the propagation picked in options, then the techniques, to a fixpoint, returns false on a contradiction
+// a technique only runs once the passes before it have nothing left
+bool bitmask_propagate(struct bitmask_state *state, sudoku_propagation level, u32 techniques) {
+    for (;;) {
+        if (!bitmask_propagate_singles(state))
+            return false;
+        
+        if (level == SUDOKU_PROPAGATE_PAIRS && bitmask_reveal_naked_pairs(state))
+            continue;
+        
+        if (!bitmask_reveal_techniques(state, techniques))
+            return true;
+    }
+}
+
+// picks the cell to branch on, the one with the fewest candidates if mrv is set, otherwise the
+// first empty cell in row-major order, returns false if there are no empty cells
+// this scans the grid because propagation changes too many cells at once for the mrv index to pay off
+bool bitmask_pick_branch_cell(const struct bitmask_state *state, bool mrv, u32 *into_cell_idx) {
+    u32 best_count = 10;
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        if (state->values[cell_idx] != 0)
+            continue;
+        
+        if (!mrv) {
+            *into_cell_idx = cell_idx;
+            return true;
+        }
+        
+        u32 count = popcount16(bitmask_cell_candidates(state, cell_idx));
+        if (count < best_count) {
+            best_count = count;
+            *into_cell_idx = cell_idx;
+            
+            // propagation already placed every single, nothing will beat a pair
+            if (count <= 2)
+                break;
+        }
+    }
+    
+    return best_count != 10;
+}
+
+bool bitmask_propagating_solve(struct bitmask_state *state, const struct sudoku_solve_options *options, struct sudoku_solve_stats *stats) {
+    if (!bitmask_propagate(state, options->propagation, options->techniques))
+        return false;
+    
+    u32 cell_idx;
+    if (!bitmask_pick_branch_cell(state, options->mrv, &cell_idx))
+        return true;
+    
+    u32 candidates = bitmask_cell_candidates(state, cell_idx);
+    
+    while (candidates) {
+        if (out_of_budget(stats->nodes))
+            return false;
+        
+        u32 value = ctz32(candidates) + 1;
+        candidates &= candidates - 1;
+        
+        struct bitmask_state guess = *state;
+        bitmask_set_value(&guess, cell_idx, value);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (bitmask_propagating_solve(&guess, options, stats)) {
+            *state = guess;
+            return true;
+        }
+        
+        // dropping the copy is the undo
+        STAT_BACKTRACK();
+    }
+    
+    return false;
+}
+
+// solutions found so far by a counting search
+struct solution_counter {
+    // stop once this many are found, 0 means find them all
+    u64 cap;
+    u64 n_solutions;
+    struct sudoku_grid first_solution;
+    
+    // when several threads count parts of one search, the solutions all of them found, NULL otherwise
+    // the cap then applies to that total, and reaching it sets cancel to stop the other threads
+    _Atomic u64 *shared_solutions;
+    atomic_bool *cancel;
+};
+
+// records a solution, returns true once the cap is reached and the search should stop
+static inline bool count_solution(struct solution_counter *counter) {
+    counter->n_solutions++;
+    
+    if (counter->shared_solutions) {
+        u64 total = atomic_fetch_add(counter->shared_solutions, 1) + 1;
+        if (counter->cap == 0 || total < counter->cap)
+            return false;
+        
+        atomic_store(counter->cancel, true);
+        return true;
+    }
+    
+    return counter->cap != 0 && counter->n_solutions >= counter->cap;
+}
+
+// like bitmask_propagating_solve but keeps going after a solution, until the whole tree
+// is searched or the cap is reached, returns true if it stopped because of the cap
+// counting always propagates at least singles since it has to visit every branch
+bool bitmask_counting_solve(struct bitmask_state *state, const struct sudoku_solve_options *options, struct solution_counter *counter, struct sudoku_solve_stats *stats) {
+    sudoku_propagation level = options->propagation == SUDOKU_PROPAGATE_NONE ? SUDOKU_PROPAGATE_SINGLES : options->propagation;
+    if (!bitmask_propagate(state, level, options->techniques))
+        return false;
+    
+    u32 cell_idx;
+    if (!bitmask_pick_branch_cell(state, options->mrv, &cell_idx)) {
+        if (counter->n_solutions == 0) {
+            for (u32 i = 0; i < 81; i++)
+                counter->first_solution.values[i / 9][i % 9] = state->values[i];
+        }
+        return count_solution(counter);
+    }
+    
+    u32 candidates = bitmask_cell_candidates(state, cell_idx);
+    
+    while (candidates) {
+        // running out of budget stops the count like reaching the cap does
+        if (out_of_budget(stats->nodes))
+            return true;
+        
+        u32 value = ctz32(candidates) + 1;
+        candidates &= candidates - 1;
+        
+        struct bitmask_state guess = *state;
+        bitmask_set_value(&guess, cell_idx, value);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (bitmask_counting_solve(&guess, options, counter, stats))
+            return true;
+        
+        STAT_BACKTRACK();
+    }
+    
+    return false;
+}
+
+// runs the logic passes the search starts from until none of them finds anything
+// the techniques turned on in techniques only run once the others have nothing left
+void bitmask_reveal_all(struct bitmask_state *state, u32 techniques) {
+    bool revealed_at_least_one;
+    
+    do {
+        revealed_at_least_one = false;
+        
+        bool found_lone_singles = bitmask_reveal_lone_singles(state);
+        
+        bool found_hidden_singles = bitmask_reveal_hidden_singles(state);
+        
+        bool found_naked_pairs = bitmask_reveal_naked_pairs(state);
+        
+        revealed_at_least_one |= found_lone_singles | found_hidden_singles | found_naked_pairs;
+        
+        if (!revealed_at_least_one)
+            revealed_at_least_one = bitmask_reveal_techniques(state, techniques);
+    } while (revealed_at_least_one);
+}
+
+// returns the number of solutions found: 0 or 1, or up to the cap when counting
+// into gets the (first) solution, or a partially filled grid if there is none
+// state and index are room for the engine's state, they do not need to be initialized
+u64 bitmask_solve(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_state, struct sudoku_grid *into,
+                  struct bitmask_state *state, struct mrv_index *index, struct sudoku_solve_stats *stats) {
+    assert(options);
+    assert(state);
+    assert(index);
+    assert(initial_state);
+    assert(stats);
+    
+    STAT_PHASE_START(setup_start);
+    
+    if (!initialize_bitmask_state(state, initial_state)) {
+        memcpy(into->values, initial_state->values, sizeof(into->values));
+        return 0;
+    }
+    
+    STAT_PHASE_END(setup_seconds, setup_start);
+    STAT_PHASE_START(logic_start);
+    
+    bitmask_reveal_all(state, options->techniques);
+    
+    STAT_PHASE_END(logic_seconds, logic_start);
+    STAT_PHASE_START(search_start);
+    
+    if (options->count_solutions) {
+        struct solution_counter counter;
+        counter.cap = options->solution_cap;
+        counter.n_solutions = 0;
+        counter.shared_solutions = NULL;
+        
+        bitmask_counting_solve(state, options, &counter, stats);
+        
+        STAT_PHASE_END(search_seconds, search_start);
+        
+        if (counter.n_solutions > 0) {
+            *into = counter.first_solution;
+        } else {
+            for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+                into->values[cell_idx / 9][cell_idx % 9] = state->values[cell_idx];
+        }
+        
+        return counter.n_solutions;
+    }
+    
+    bool success;
+    if (options->mrv)
+        initialize_mrv_index(index, state);
+    
+    if (options->propagation != SUDOKU_PROPAGATE_NONE)
+        success = bitmask_propagating_solve(state, options, stats);
+    else if (options->iterative && options->mrv)
+        success = bitmask_mrv_iterative_solve(state, index, stats);
+    else if (options->iterative)
+        success = bitmask_iterative_solve(state, stats);
+    else if (options->mrv)
+        success = bitmask_mrv_recursive_solve(state, index, stats);
+    else
+        success = bitmask_recursive_solve(state, 0, stats);
+    
+    STAT_PHASE_END(search_seconds, search_start);
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        into->values[cell_idx / 9][cell_idx % 9] = state->values[cell_idx];
+    
+    return success ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// dancing links engine
+//
+// sudoku as an exact cover problem: every (cell, value) pair is a row that covers 4 of the
+// 324 columns, one for each of "cell is filled", "row has value", "col has value" and
+// "box has value", a solution is 81 rows that cover every column exactly once
+// solved with knuth's algorithm x, the matrix is a fixed-size pool of nodes linked by u16
+// indices so a solve does not allocate anything
+// ---------------------------------------------------------------------------
+
+#define DLX_N_COLUMNS 324
+#define DLX_N_ROWS 729
+
+// node 0 is the root, nodes 1-324 are the column headers, the rest are the 4 nodes of each row
+#define DLX_ROOT 0
+#define DLX_N_NODES (1 + DLX_N_COLUMNS + DLX_N_ROWS * 4)
+
+struct dlx_state {
+    u16 left[DLX_N_NODES];
+    u16 right[DLX_N_NODES];
+    u16 up[DLX_N_NODES];
+    u16 down[DLX_N_NODES];
+    
+    // header node of the column a node is in
+    u16 column[DLX_N_NODES];
+    
+    // for row nodes, the row they belong to: cell_idx * 9 + value - 1
+    u16 row[DLX_N_NODES];
+    
+    // number of rows still in each column, indexed by header node
+    u16 size[1 + DLX_N_COLUMNS];
+    
+    // rows picked by the search, the givens are not in here
+    u16 picked_rows[81];
+    u32 n_picked;
+};
+
+void dlx_cover(struct dlx_state *dlx, u32 col) {
+    dlx->right[dlx->left[col]] = dlx->right[col];
+    dlx->left[dlx->right[col]] = dlx->left[col];
+    
+    for (u32 i = dlx->down[col]; i != col; i = dlx->down[i]) {
+        for (u32 j = dlx->right[i]; j != i; j = dlx->right[j]) {
+            dlx->down[dlx->up[j]] = dlx->down[j];
+            dlx->up[dlx->down[j]] = dlx->up[j];
+            dlx->size[dlx->column[j]]--;
+        }
+    }
+}
+
+// exact reverse of dlx_cover, the links are restored in the opposite order
+void dlx_uncover(struct dlx_state *dlx, u32 col) {
+    for (u32 i = dlx->up[col]; i != col; i = dlx->up[i]) {
+        for (u32 j = dlx->left[i]; j != i; j = dlx->left[j]) {
+            dlx->size[dlx->column[j]]++;
+            dlx->down[dlx->up[j]] = j;
+            dlx->up[dlx->down[j]] = j;
+        }
+    }
+    
+    dlx->right[dlx->left[col]] = col;
+    dlx->left[dlx->right[col]] = col;
+}
+
+// builds the full 729 x 324 matrix, then removes the rows and columns taken by the givens
+// returns false if two givens fight over a column, meaning the puzzle has no solution
+bool initialize_dlx_state(struct dlx_state *dlx, const struct sudoku_grid *initial_state) {
+    for (u32 col = 0; col <= DLX_N_COLUMNS; col++) {
+        dlx->left[col] = (u16) (col == 0 ? DLX_N_COLUMNS : col - 1);
+        dlx->right[col] = (u16) (col == DLX_N_COLUMNS ? 0 : col + 1);
+        dlx->up[col] = (u16) col;
+        dlx->down[col] = (u16) col;
+        dlx->column[col] = (u16) col;
+        dlx->size[col] = 0;
+    }
+    
+    u32 next_node = 1 + DLX_N_COLUMNS;
+    
+    for (u32 row = 0; row < DLX_N_ROWS; row++) {
+        u32 cell_idx = row / 9;
+        u32 value_idx = row % 9;
+        
+        u32 columns[4];
+        columns[0] = 1 + cell_idx;
+        columns[1] = 1 + 81 + cell_row_lookup[cell_idx] * 9 + value_idx;
+        columns[2] = 1 + 162 + cell_col_lookup[cell_idx] * 9 + value_idx;
+        columns[3] = 1 + 243 + cell_box_lookup[cell_idx] * 9 + value_idx;
+        
+        u32 first = next_node;
+        for (u32 i = 0; i < 4; i++) {
+            u32 node = next_node++;
+            u32 col = columns[i];
+            
+            dlx->left[node] = (u16) (i == 0 ? first + 3 : node - 1);
+            dlx->right[node] = (u16) (i == 3 ? first : node + 1);
+            
+            // append to the bottom of the column
+            dlx->up[node] = dlx->up[col];
+            dlx->down[node] = (u16) col;
+            dlx->down[dlx->up[col]] = (u16) node;
+            dlx->up[col] = (u16) node;
+            
+            dlx->column[node] = (u16) col;
+            dlx->row[node] = (u16) row;
+            dlx->size[col]++;
+        }
+    }
+    
+    assert(next_node == DLX_N_NODES);
+    
+    dlx->n_picked = 0;
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        u32 value = initial_state->values[cell_idx / 9][cell_idx % 9];
+        if (value == 0)
+            continue;
+        
+        // row nodes are laid out in row order, 4 per row
+        u32 first = 1 + DLX_N_COLUMNS + (cell_idx * 9 + value - 1) * 4;
+        
+        for (u32 node = first; node < first + 4; node++) {
+            u32 col = dlx->column[node];
+            
+            // a covered column is unlinked from its neighbours
+            if (dlx->right[dlx->left[col]] != col)
+                return false;
+            
+            dlx_cover(dlx, col);
+        }
+    }
+    
+    return true;
+}
+
+bool dlx_search(struct dlx_state *dlx, struct sudoku_solve_stats *stats) {
+    // every column is covered, that means we have solved it
+    if (dlx->right[DLX_ROOT] == DLX_ROOT)
+        return true;
+    
+    // branch on the column with the fewest rows left
+    u32 col = dlx->right[DLX_ROOT];
+    for (u32 other = dlx->right[col]; other != DLX_ROOT; other = dlx->right[other]) {
+        if (dlx->size[other] < dlx->size[col])
+            col = other;
+    }
+    
+    if (dlx->size[col] == 0)
+        return false;
+    
+    dlx_cover(dlx, col);
+    
+    for (u32 i = dlx->down[col]; i != col; i = dlx->down[i]) {
+        if (out_of_budget(stats->nodes))
+            break;
+        
+        dlx->picked_rows[dlx->n_picked++] = dlx->row[i];
+        for (u32 j = dlx->right[i]; j != i; j = dlx->right[j])
+            dlx_cover(dlx, dlx->column[j]);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        if (dlx_search(dlx, stats))
+            return true;
+        
+        for (u32 j = dlx->left[i]; j != i; j = dlx->left[j])
+            dlx_uncover(dlx, dlx->column[j]);
+        dlx->n_picked--;
+        STAT_BACKTRACK();
+    }
+    
+    dlx_uncover(dlx, col);
+    
+    return false;
+}
+
+// fills the rows picked so far into a grid that already holds the givens
+void dlx_write_picked_rows(const struct dlx_state *dlx, struct sudoku_grid *into) {
+    for (u32 i = 0; i < dlx->n_picked; i++) {
+        u32 row = dlx->picked_rows[i];
+        into->values[row / 81][row / 9 % 9] = row % 9 + 1;
+    }
+}
+
+// counting version of dlx_search, returns true if it stopped because the cap was reached
+// counter->first_solution must hold the givens
+bool dlx_count_search(struct dlx_state *dlx, struct solution_counter *counter, struct sudoku_solve_stats *stats) {
+    if (dlx->right[DLX_ROOT] == DLX_ROOT) {
+        if (counter->n_solutions == 0)
+            dlx_write_picked_rows(dlx, &counter->first_solution);
+        return count_solution(counter);
+    }
+    
+    u32 col = dlx->right[DLX_ROOT];
+    for (u32 other = dlx->right[col]; other != DLX_ROOT; other = dlx->right[other]) {
+        if (dlx->size[other] < dlx->size[col])
+            col = other;
+    }
+    
+    if (dlx->size[col] == 0)
+        return false;
+    
+    dlx_cover(dlx, col);
+    
+    for (u32 i = dlx->down[col]; i != col; i = dlx->down[i]) {
+        // running out of budget stops the count like reaching the cap does
+        if (out_of_budget(stats->nodes))
+            return true;
+        
+        dlx->picked_rows[dlx->n_picked++] = dlx->row[i];
+        for (u32 j = dlx->right[i]; j != i; j = dlx->right[j])
+            dlx_cover(dlx, dlx->column[j]);
+        stats->nodes++;
+        STAT_ENTER_GUESS();
+        
+        // the links are left as they are once the cap is hit, the matrix is not used again
+        if (dlx_count_search(dlx, counter, stats))
+            return true;
+        
+        for (u32 j = dlx->left[i]; j != i; j = dlx->left[j])
+            dlx_uncover(dlx, dlx->column[j]);
+        dlx->n_picked--;
+        STAT_BACKTRACK();
+    }
+    
+    dlx_uncover(dlx, col);
+    
+    return false;
+}
+
+// returns the number of solutions found: 0 or 1, or up to the cap when counting
+// dlx is room for the matrix, about 40KB, it does not need to be initialized
+u64 dlx_solve(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_state, struct sudoku_grid *into, struct dlx_state *dlx, struct sudoku_solve_stats *stats) {
+    assert(options);
+    assert(dlx);
+    assert(initial_state);
+    assert(stats);
+    
+    STAT_PHASE_START(setup_start);
+    
+    bool consistent = initialize_dlx_state(dlx, initial_state);
+    
+    STAT_PHASE_END(setup_seconds, setup_start);
+    STAT_PHASE_START(search_start);
+    
+    memcpy(into->values, initial_state->values, sizeof(into->values));
+    
+    u64 n_solutions = 0;
+    
+    if (consistent && options->count_solutions) {
+        struct solution_counter counter;
+        counter.cap = options->solution_cap;
+        counter.n_solutions = 0;
+        counter.first_solution = *initial_state;
+        counter.shared_solutions = NULL;
+        
+        dlx_count_search(dlx, &counter, stats);
+        
+        *into = counter.first_solution;
+        n_solutions = counter.n_solutions;
+    } else if (consistent && dlx_search(dlx, stats)) {
+        dlx_write_picked_rows(dlx, into);
+        n_solutions = 1;
+    }
+    
+    STAT_PHASE_END(search_seconds, search_start);
+    
+    return n_solutions;
+}
+
+// the state the engines work on besides their call stack, it is too big for the small stacks
+// some threads get (the dlx matrix alone is about 40KB), so whoever solves decides where it lives
+struct solve_workspace {
+    union {
+        struct {
+            struct solve_state state;
+            struct backjump_state backjump;
+        } collisions;
+        
+        struct {
+            struct bitmask_state state;
+            struct mrv_index index;
+        } bitmask;
+        
+        struct dlx_state dlx;
+    };
+};
+
+// runs the engine picked in options on initial_state within the budget in options
+// returns SUDOKU_TIMED_OUT if the budget ran out before the search finished
+u64 run_engine(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_state, struct sudoku_grid *into,
+               struct solve_workspace *workspace, struct sudoku_solve_stats *stats) {
+    search_budget_start(options, stats->nodes, NULL);
+    
+    u64 n_solutions = 0;
+    switch (options->engine) {
+        case SUDOKU_ENGINE_COLLISIONS:
+            n_solutions = solve(options, initial_state, into, &workspace->collisions.state, &workspace->collisions.backjump, stats) ? 1 : 0;
+            break;
+        
+        case SUDOKU_ENGINE_BITMASK:
+            n_solutions = bitmask_solve(options, initial_state, into, &workspace->bitmask.state, &workspace->bitmask.index, stats);
+            break;
+        
+        case SUDOKU_ENGINE_DLX:
+            n_solutions = dlx_solve(options, initial_state, into, &workspace->dlx, stats);
+            break;
+    }
+    
+    return active_budget.exhausted ? SUDOKU_TIMED_OUT : n_solutions;
+}
+
+// solves initial_state into into with the engine picked in options
+// returns the number of solutions found, 0 if the puzzle has none, at most 1 unless counting,
+// or SUDOKU_TIMED_OUT if it ran out of budget (and out of the requeue engine's budget with requeue set)
+// stats are added to
+u64 solve_with_options(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_state, struct sudoku_grid *into,
+                       struct solve_workspace *workspace, struct sudoku_solve_stats *stats) {
+    assert(options);
+    assert(workspace);
+    assert(stats);
+    
+#if defined(SUDOKU_STATS)
+    active_stats = stats;
+    stats->depth = 0;
+#endif
+    
+    // counting is not supported by the collisions engine
+    assert(!options->count_solutions || options->engine != SUDOKU_ENGINE_COLLISIONS);
+    
+    // the puzzle the engine gets, with whatever the singles pre-pass placed
+    struct sudoku_grid reduced;
+    
+    if (options->tiered) {
+        // the bitmask state is a few hundred bytes and singles are all it is asked for, which
+        // finishes easy puzzles before any engine builds its state
+        struct bitmask_state singles;
+        bool consistent = initialize_bitmask_state(&singles, initial_state) && bitmask_propagate_singles(&singles);
+        
+        if (!consistent) {
+            // the engines report it the same way, with the givens as the partial state
+            *into = *initial_state;
+            stats->singles_tier++;
+            return 0;
+        }
+        
+        bool filled_out = true;
+        for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+            reduced.values[cell_idx / 9][cell_idx % 9] = singles.values[cell_idx];
+            filled_out &= singles.values[cell_idx] != 0;
+        }
+        
+        // every placement was forced, so this is the only solution
+        if (filled_out) {
+            *into = reduced;
+            stats->singles_tier++;
+            return 1;
+        }
+        
+        stats->engine_tier++;
+        initial_state = &reduced;
+    }
+    
+    u64 n_solutions = run_engine(options, initial_state, into, workspace, stats);
+    
+    if (n_solutions == SUDOKU_TIMED_OUT && options->requeue) {
+        // the options that only the bitmask engine supports are dropped for the others,
+        // and turned up for it, a plain search is what got stuck in the first place
+        struct sudoku_solve_options retry = *options;
+        retry.engine = options->requeue_engine;
+        retry.iterative = false;
+        retry.mrv = retry.engine == SUDOKU_ENGINE_BITMASK;
+        if (retry.engine != SUDOKU_ENGINE_BITMASK)
+            retry.propagation = SUDOKU_PROPAGATE_NONE;
+        else if (retry.propagation == SUDOKU_PROPAGATE_NONE)
+            retry.propagation = SUDOKU_PROPAGATE_SINGLES;
+        
+        assert(!retry.count_solutions || retry.engine != SUDOKU_ENGINE_COLLISIONS);
+        
+        stats->requeues++;
+        n_solutions = run_engine(&retry, initial_state, into, workspace, stats);
+    }
+    
+    if (n_solutions == SUDOKU_TIMED_OUT)
+        stats->timeouts++;
+    
+    return n_solutions;
+}
+
+// ---------------------------------------------------------------------------
+// lockstep propagation
+//
+// most puzzles of an easy or medium collection fall to lone and hidden singles alone, so
+// paying each one's setup and search entry on its own is mostly overhead
+// instead up to 16 puzzles are propagated together, one per 16 bit lane of an avx2 register:
+// group.cells[c] holds cell c of every puzzle, a placed cell is one whose mask has a single bit,
+// and each pass over the 27 units removes placed values from their peers and narrows hidden
+// singles for all the puzzles at once until none of them changes
+// the puzzles singles do not finish drop out to the engine picked in the options
+// ---------------------------------------------------------------------------
+
+#define LOCKSTEP_LANES 16
+
+struct lockstep_group {
+    // cells[c][lane] is the candidate mask of cell c of the lane's puzzle
+    _Alignas(32) u16 cells[81][LOCKSTEP_LANES];
+    
+    // lane bits of the puzzles that turned out to be contradictory
+    u32 contradictions;
+};
+
+#if defined(SUDOKU_X86_64)
+
+// propagates singles in all the lanes of group until none of them changes
+TARGET_AVX2
+void lockstep_propagate_avx2(struct lockstep_group *group) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i all_candidates = _mm256_set1_epi16(ALL_CANDIDATES);
+    
+    __m256i *cells = (__m256i *) group->cells;
+    
+    // all ones in the lanes that are contradictory
+    __m256i contradiction = zero;
+    __m256i changed;
+    
+    do {
+        changed = zero;
+        
+        for (u32 unit_idx = 0; unit_idx < 27; unit_idx++) {
+            const u8 *unit = unit_cells[unit_idx];
+            
+            // values seen in at least one/two cells, and values placed once/twice in the unit
+            __m256i seen_once = zero;
+            __m256i seen_twice = zero;
+            __m256i placed = zero;
+            __m256i placed_twice = zero;
+            
+            for (u32 i = 0; i < 9; i++) {
+                __m256i mask = _mm256_load_si256(&cells[unit[i]]);
+                __m256i is_placed = _mm256_cmpeq_epi16(_mm256_and_si256(mask, _mm256_sub_epi16(mask, one)), zero);
+                __m256i placed_value = _mm256_and_si256(mask, is_placed);
+                
+                placed_twice = _mm256_or_si256(placed_twice, _mm256_and_si256(placed, placed_value));
+                placed = _mm256_or_si256(placed, placed_value);
+                seen_twice = _mm256_or_si256(seen_twice, _mm256_and_si256(seen_once, mask));
+                seen_once = _mm256_or_si256(seen_once, mask);
+            }
+            
+            // a value placed twice, or one that has no cell left
+            contradiction = _mm256_or_si256(contradiction, _mm256_xor_si256(_mm256_cmpeq_epi16(placed_twice, zero), _mm256_cmpeq_epi16(zero, zero)));
+            contradiction = _mm256_or_si256(contradiction, _mm256_xor_si256(_mm256_cmpeq_epi16(seen_once, all_candidates), _mm256_cmpeq_epi16(zero, zero)));
+            
+            __m256i hidden_singles = _mm256_andnot_si256(_mm256_or_si256(seen_twice, placed), seen_once);
+            
+            for (u32 i = 0; i < 9; i++) {
+                __m256i mask = _mm256_load_si256(&cells[unit[i]]);
+                __m256i is_placed = _mm256_cmpeq_epi16(_mm256_and_si256(mask, _mm256_sub_epi16(mask, one)), zero);
+                
+                // placed cells keep their value, the rest lose the placed values
+                __m256i narrowed = _mm256_andnot_si256(_mm256_andnot_si256(is_placed, placed), mask);
+                
+                // a cell holding a hidden single is narrowed to it, holding two is a contradiction
+                __m256i hidden = _mm256_and_si256(narrowed, hidden_singles);
+                __m256i no_hidden = _mm256_cmpeq_epi16(hidden, zero);
+                narrowed = _mm256_or_si256(_mm256_and_si256(narrowed, no_hidden), hidden);
+                
+                __m256i several_hidden = _mm256_cmpeq_epi16(_mm256_and_si256(hidden, _mm256_sub_epi16(hidden, one)), zero);
+                contradiction = _mm256_or_si256(contradiction, _mm256_andnot_si256(several_hidden, _mm256_cmpeq_epi16(zero, zero)));
+                contradiction = _mm256_or_si256(contradiction, _mm256_cmpeq_epi16(narrowed, zero));
+                
+                changed = _mm256_or_si256(changed, _mm256_xor_si256(mask, narrowed));
+                _mm256_store_si256(&cells[unit[i]], narrowed);
+            }
+        }
+        
+        // contradictory lanes only shrink towards all zeros, there is no point waiting for them
+        changed = _mm256_andnot_si256(contradiction, changed);
+    } while (!_mm256_testz_si256(changed, changed));
+    
+    // one bit per lane out of the two per byte movemask gives
+    u32 byte_bits = (u32) _mm256_movemask_epi8(contradiction);
+    u32 lane_bits = 0;
+    for (u32 lane = 0; lane < LOCKSTEP_LANES; lane++)
+        lane_bits |= ((byte_bits >> (lane * 2)) & 1) << lane;
+    group->contradictions = lane_bits;
+}
+
+#endif
+
+// set by select_simd_kernels, NULL if the cpu cannot run the lockstep kernel
+void (*lockstep_propagate)(struct lockstep_group *group) = NULL;
+
+// solves initial_states[0..n_grids) like solve_with_options does each of them, n_grids <= LOCKSTEP_LANES
+// puzzles singles solve are not passed to the engine and get no stats, the rest are passed to it
+// with every single already placed
+void solve_lockstep(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_states, u32 n_grids,
+                    struct sudoku_grid *solutions, u64 *solution_counts, struct solve_workspace *workspace, struct sudoku_solve_stats *puzzle_stats) {
+    assert(lockstep_propagate);
+    assert(n_grids >= 1 && n_grids <= LOCKSTEP_LANES);
+    
+    struct lockstep_group group;
+    
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        for (u32 lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            // unused lanes repeat the first puzzle
+            u32 value = initial_states[lane < n_grids ? lane : 0].values[cell_idx / 9][cell_idx % 9];
+            group.cells[cell_idx][lane] = value ? 1 << (value - 1) : ALL_CANDIDATES;
+        }
+    }
+    
+    lockstep_propagate(&group);
+    
+    for (u32 lane = 0; lane < n_grids; lane++) {
+        struct sudoku_grid *solution = &solutions[lane];
+        bool filled_out = true;
+        
+        for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+            u16 mask = group.cells[cell_idx][lane];
+            bool is_placed = mask != 0 && (mask & (mask - 1)) == 0;
+            
+            solution->values[cell_idx / 9][cell_idx % 9] = is_placed ? ctz32(mask) + 1 : 0;
+            filled_out &= is_placed;
+        }
+        
+        if (group.contradictions & (1 << lane)) {
+            // the engines report it the same way, with the givens as the partial state
+            *solution = initial_states[lane];
+            solution_counts[lane] = 0;
+        } else if (filled_out) {
+            // every value was forced, so this is the only solution
+            solution_counts[lane] = 1;
+        } else {
+            struct sudoku_grid reduced = *solution;
+            solution_counts[lane] = solve_with_options(options, &reduced, solution, workspace, &puzzle_stats[lane]);
+        }
+    }
+}
+
+// picks the kernels to use, KERNEL_AUTO picks the best ones the cpu supports
+// the lockstep kernel needs avx2, without it lockstep batches fall back to one puzzle at a time
+// returns the level that was picked, which is lower than the requested one if the cpu cannot run it
+kernel_level select_simd_kernels(kernel_level requested) {
+#if defined(SUDOKU_X86_64)
+    // sse2 is part of x86-64, only avx2 has to be checked for
+    if ((requested == KERNEL_AUTO || requested == KERNEL_AVX2) && cpu_has_avx2()) {
+        candidate_masks = candidate_masks_avx2;
+        lockstep_propagate = lockstep_propagate_avx2;
+        return KERNEL_AVX2;
+    }
+    
+    if (requested != KERNEL_SCALAR) {
+        candidate_masks = candidate_masks_sse2;
+        return KERNEL_SSE2;
+    }
+#else
+    (void) requested;
+#endif
+    
+    candidate_masks = candidate_masks_scalar;
+    return KERNEL_SCALAR;
+}
+
+// ---------------------------------------------------------------------------
+// canonical form and solution cache
+//
+// relabeling digits, permuting the rows of a band, the columns of a stack, the bands, the stacks
+// and transposing all map a puzzle to one with the same number of solutions, and map its solutions
+// to the other puzzle's solutions
+// the canonical form of a puzzle is the smallest of all those puzzles, compared first by where the
+// givens are (the pattern) and then by the givens read in row-major order with digits numbered in
+// order of first appearance, so puzzles that are the same up to these symmetries share one form
+// the cache maps canonical forms to their solutions, a hit maps the cached solution back through
+// the transform instead of solving again
+// ---------------------------------------------------------------------------
+
+// the 6 orders of 3 things
+static const u8 perms3[6][3] = { {0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0} };
+
+// maps a puzzle to its canonical form, canonical[r][c] = digit_map[source[rows[r]][cols[c]]] where
+// source is the puzzle, or the transposed puzzle if transposed is set
+struct grid_transform {
+    bool transposed;
+    u8 rows[9];
+    u8 cols[9];
+    u8 digit_map[10];
+};
+
+// the givens of a row as a 9 bit mask, col 0 is the highest bit so comparing masks compares the
+// rows left to right, and masks of 3 columns are cut out of it the same way
+static inline u32 stack_bits(u32 row_mask, u32 stack) {
+    return (row_mask >> (3 * (2 - stack))) & 7;
+}
+
+// perm3_bits[perm][bits] reorders the 3 columns of bits, column i of the result is column perms3[perm][i]
+static u8 perm3_bits[6][8];
+
+static void init_perm3_bits(void) {
+    for (u32 perm = 0; perm < 6; perm++) {
+        for (u32 bits = 0; bits < 8; bits++) {
+            u32 result = 0;
+            for (u32 i = 0; i < 3; i++) {
+                if (bits & (4 >> perms3[perm][i]))
+                    result |= 4 >> i;
+            }
+            perm3_bits[perm][bits] = (u8) result;
+        }
+    }
+}
+
+static once_flag perm3_bits_once = ONCE_FLAG_INIT;
+
+// sorts the masks of each band and the bands by their sorted masks, which is the smallest order of
+// the rows, order[i] is the row that ends up at position i
+// the 9 masks in that order are packed into 81 bits of key, row 0 first, so keys compare like patterns
+static void order_rows(const u16 masks[9], u8 order[9], u64 key[2]) {
+    u8 bands[3][3];
+    for (u32 band = 0; band < 3; band++) {
+        u8 *rows = bands[band];
+        rows[0] = (u8) (band * 3);
+        rows[1] = (u8) (band * 3 + 1);
+        rows[2] = (u8) (band * 3 + 2);
+        
+#define SORT_ROWS(a, b) if (masks[rows[b]] < masks[rows[a]]) { u8 tmp = rows[a]; rows[a] = rows[b]; rows[b] = tmp; }
+        SORT_ROWS(0, 1);
+        SORT_ROWS(1, 2);
+        SORT_ROWS(0, 1);
+#undef SORT_ROWS
+    }
+    
+    u64 band_keys[3];
+    for (u32 band = 0; band < 3; band++)
+        band_keys[band] = (u64) masks[bands[band][0]] << 18 | (u64) masks[bands[band][1]] << 9 | masks[bands[band][2]];
+    
+    u8 band_order[3] = {0, 1, 2};
+#define SORT_BANDS(a, b) if (band_keys[band_order[b]] < band_keys[band_order[a]]) { u8 tmp = band_order[a]; band_order[a] = band_order[b]; band_order[b] = tmp; }
+    SORT_BANDS(0, 1);
+    SORT_BANDS(1, 2);
+    SORT_BANDS(0, 1);
+#undef SORT_BANDS
+    
+    for (u32 i = 0; i < 9; i++)
+        order[i] = bands[band_order[i / 3]][i % 3];
+    
+    // 7 rows in the first word, 2 in the second
+    key[0] = band_keys[band_order[0]] << 27 | band_keys[band_order[1]];
+    key[0] = key[0] << 9 | masks[order[6]];
+    key[1] = (u64) masks[order[7]] << 9 | masks[order[8]];
+}
+
+static inline u32 transformed_value(const struct sudoku_grid *puzzle, bool transposed, u32 row, u32 col) {
+    return transposed ? puzzle->values[col][row] : puzzle->values[row][col];
+}
+
+static inline bool key_below(const u64 a[2], const u64 b[2]) {
+    return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+}
+
+// with the masks of every row at most what the column orders still open can make of them, their
+// sorted key is at most the key of any pattern those orders give, so a key above the best one cuts
+// them all off
+static inline bool pattern_may_win(const u16 masks[9], const u64 best_key[2]) {
+    u8 order[9];
+    u64 key[2];
+    order_rows(masks, order, key);
+    return !key_below(best_key, key);
+}
+
+// the smallest mask a column transform can give a row: the givens of every stack moved to its right
+// end and the stacks in increasing order of their givens, smallest_chunks[stack] is that stack's part
+static u16 smallest_row_mask(u16 row_mask, u8 smallest_chunks[3]) {
+    for (u32 stack = 0; stack < 3; stack++)
+        smallest_chunks[stack] = (u8) ((1 << popcount16((u16) stack_bits(row_mask, stack))) - 1);
+    
+    u8 sorted[3] = {smallest_chunks[0], smallest_chunks[1], smallest_chunks[2]};
+#define SORT_CHUNKS(a, b) if (sorted[b] < sorted[a]) { u8 tmp = sorted[a]; sorted[a] = sorted[b]; sorted[b] = tmp; }
+    SORT_CHUNKS(0, 1);
+    SORT_CHUNKS(1, 2);
+    SORT_CHUNKS(0, 1);
+#undef SORT_CHUNKS
+    
+    return (u16) (sorted[0] << 6 | sorted[1] << 3 | sorted[2]);
+}
+
+// the work canonicalizing may take is bounded: puzzles with fewer givens than any puzzle with one
+// solution are not canonicalized at all, and neither are puzzles whose pattern is left as it is by
+// more transforms than are looked at (nearly empty or very symmetric puzzles), both are solved
+// without the cache
+#define MIN_CANONICAL_GIVENS 17
+#define MAX_CANONICAL_CANDIDATES 64
+#define MAX_CANONICAL_TRANSFORMS 512
+
+// writes the canonical form of puzzle to canonical and the transform that gives it to transform,
+// returns false for a puzzle that is not worth the work, see above
+bool canonicalize(const struct sudoku_grid *puzzle, struct sudoku_grid *canonical, struct grid_transform *transform) {
+    u32 n_givens = 0;
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        n_givens += puzzle->values[cell_idx / 9][cell_idx % 9] != 0;
+    if (n_givens < MIN_CANONICAL_GIVENS)
+        return false;
+    
+    call_once(&perm3_bits_once, init_perm3_bits);
+    
+    u16 row_masks[2][9];
+    u16 smallest_masks[2][9];
+    u8 smallest_chunks[2][9][3];
+    u16 first_row = 511;
+    for (u32 transposed = 0; transposed < 2; transposed++) {
+        for (u32 row = 0; row < 9; row++) {
+            row_masks[transposed][row] = 0;
+            for (u32 col = 0; col < 9; col++) {
+                if (transformed_value(puzzle, transposed, row, col))
+                    row_masks[transposed][row] |= 256 >> col;
+            }
+            
+            u16 smallest = smallest_row_mask(row_masks[transposed][row], smallest_chunks[transposed][row]);
+            smallest_masks[transposed][row] = smallest;
+            first_row = smallest < first_row ? smallest : first_row;
+        }
+    }
+    
+    u64 best_key[2] = {UINT64_MAX, UINT64_MAX};
+    u16 pattern[9];
+    struct grid_transform candidates[MAX_CANONICAL_CANDIDATES];
+    u32 n_candidates = 0;
+    
+    // the first row of a pattern is its smallest row, so the smallest pattern starts with the smallest
+    // mask any row can be given, and only the column transforms that give some row that mask are tried
+    for (u32 transposed = 0; transposed < 2; transposed++) {
+        const u16 *masks_in = row_masks[transposed];
+        u8 (*chunks_in)[3] = smallest_chunks[transposed];
+        
+        // allowed[stack_perm][perm0][perm1][perm2] marks those transforms by stack order and the column
+        // order of each stack in its new place, allowed_above marks the stack orders and first column
+        // orders with any of them below, and allowed_above[..][..][perm1 + 1] the first two orders
+        bool allowed[6][6][6][6] = {0};
+        bool allowed_above[6][6][7] = {0};
+        
+        for (u32 first = 0; first < 9; first++) {
+            if (smallest_masks[transposed][first] != first_row)
+                continue;
+            const u8 *chunks = chunks_in[first];
+            
+            // the column orders of each stack that move the givens of the row to its right end
+            u8 stack_perms[3][6];
+            u32 n_stack_perms[3] = {0};
+            for (u32 stack = 0; stack < 3; stack++) {
+                for (u32 perm = 0; perm < 6; perm++) {
+                    if (perm3_bits[perm][stack_bits(masks_in[first], stack)] == chunks[stack])
+                        stack_perms[stack][n_stack_perms[stack]++] = (u8) perm;
+                }
+            }
+            
+            for (u32 stack_perm = 0; stack_perm < 6; stack_perm++) {
+                const u8 *stacks = perms3[stack_perm];
+                if (chunks[stacks[0]] > chunks[stacks[1]] || chunks[stacks[1]] > chunks[stacks[2]])
+                    continue;
+                
+                for (u32 i0 = 0; i0 < n_stack_perms[stacks[0]]; i0++) {
+                    u32 perm0 = stack_perms[stacks[0]][i0];
+                    allowed_above[stack_perm][perm0][0] = true;
+                    for (u32 i1 = 0; i1 < n_stack_perms[stacks[1]]; i1++) {
+                        u32 perm1 = stack_perms[stacks[1]][i1];
+                        allowed_above[stack_perm][perm0][perm1 + 1] = true;
+                        for (u32 i2 = 0; i2 < n_stack_perms[stacks[2]]; i2++)
+                            allowed[stack_perm][perm0][perm1][stack_perms[stacks[2]][i2]] = true;
+                    }
+                }
+            }
+        }
+        
+        // the stacks are placed one at a time and cut off as soon as the columns placed so far cannot
+        // give a pattern as small as the best one
+        for (u32 stack_perm = 0; stack_perm < 6; stack_perm++) {
+            const u8 *stacks = perms3[stack_perm];
+            
+            for (u32 perm0 = 0; perm0 < 6; perm0++) {
+                if (!allowed_above[stack_perm][perm0][0])
+                    continue;
+                
+                u16 masks0[9];
+                u16 bounds[9];
+                for (u32 row = 0; row < 9; row++) {
+                    masks0[row] = perm3_bits[perm0][stack_bits(masks_in[row], stacks[0])];
+                    bounds[row] = (u16) (masks0[row] << 6 | chunks_in[row][stacks[1]] << 3 | chunks_in[row][stacks[2]]);
+                }
+                if (!pattern_may_win(bounds, best_key))
+                    continue;
+                
+                for (u32 perm1 = 0; perm1 < 6; perm1++) {
+                    if (!allowed_above[stack_perm][perm0][perm1 + 1])
+                        continue;
+                    
+                    u16 masks1[9];
+                    for (u32 row = 0; row < 9; row++) {
+                        masks1[row] = (u16) (masks0[row] << 3 | perm3_bits[perm1][stack_bits(masks_in[row], stacks[1])]);
+                        bounds[row] = (u16) (masks1[row] << 3 | chunks_in[row][stacks[2]]);
+                    }
+                    if (!pattern_may_win(bounds, best_key))
+                        continue;
+                    
+                    for (u32 perm2 = 0; perm2 < 6; perm2++) {
+                        if (!allowed[stack_perm][perm0][perm1][perm2])
+                            continue;
+                        
+                        u32 perms[3] = {perm0, perm1, perm2};
+                        u16 masks[9];
+                        for (u32 row = 0; row < 9; row++)
+                            masks[row] = (u16) (masks1[row] << 3 | perm3_bits[perm2][stack_bits(masks_in[row], stacks[2])]);
+                        
+                        u8 order[9];
+                        u64 key[2];
+                        order_rows(masks, order, key);
+                        if (key_below(best_key, key))
+                            continue;
+                        
+                        if (key_below(key, best_key)) {
+                            best_key[0] = key[0];
+                            best_key[1] = key[1];
+                            for (u32 i = 0; i < 9; i++)
+                                pattern[i] = masks[order[i]];
+                            n_candidates = 0;
+                        }
+                        
+                        // counted past the end to know there were too many
+                        if (n_candidates++ >= MAX_CANONICAL_CANDIDATES)
+                            continue;
+                        
+                        struct grid_transform *candidate = &candidates[n_candidates - 1];
+                        candidate->transposed = transposed;
+                        memcpy(candidate->rows, order, 9);
+                        for (u32 col = 0; col < 9; col++)
+                            candidate->cols[col] = (u8) (stacks[col / 3] * 3 + perms3[perms[col / 3]][col % 3]);
+                    }
+                }
+            }
+        }
+    }
+    
+    if (n_candidates > MAX_CANONICAL_CANDIDATES)
+        return false;
+    
+    // rows with equal masks can be swapped, and bands with equal masks too, without changing the pattern,
+    // row_orders are the orders of the rows of the pattern that leave it as it is
+    // band_row_perms[band] are the orders of the rows of a band that leave its masks as they are
+    u8 band_row_perms[3][6];
+    u32 n_band_row_perms[3] = {0};
+    for (u32 band = 0; band < 3; band++) {
+        const u16 *masks = &pattern[band * 3];
+        for (u32 perm = 0; perm < 6; perm++) {
+            const u8 *rows = perms3[perm];
+            if (masks[rows[0]] == masks[0] && masks[rows[1]] == masks[1] && masks[rows[2]] == masks[2])
+                band_row_perms[band][n_band_row_perms[band]++] = (u8) perm;
+        }
+    }
+    
+    // bands can only trade places with bands of the same masks, which have the same row orders
+    bool band_perm_keeps[6];
+    u32 n_row_orders = 0;
+    for (u32 band_perm = 0; band_perm < 6; band_perm++) {
+        band_perm_keeps[band_perm] = true;
+        for (u32 i = 0; i < 9; i++)
+            band_perm_keeps[band_perm] &= pattern[perms3[band_perm][i / 3] * 3 + i % 3] == pattern[i];
+        if (band_perm_keeps[band_perm])
+            n_row_orders += n_band_row_perms[0] * n_band_row_perms[1] * n_band_row_perms[2];
+    }
+    
+    if (n_candidates * n_row_orders > MAX_CANONICAL_TRANSFORMS)
+        return false;
+    
+    u8 row_orders[MAX_CANONICAL_TRANSFORMS][9];
+    n_row_orders = 0;
+    for (u32 band_perm = 0; band_perm < 6; band_perm++) {
+        if (!band_perm_keeps[band_perm])
+            continue;
+        
+        for (u32 perm0 = 0; perm0 < n_band_row_perms[0]; perm0++) {
+            for (u32 perm1 = 0; perm1 < n_band_row_perms[1]; perm1++) {
+                for (u32 perm2 = 0; perm2 < n_band_row_perms[2]; perm2++) {
+                    u32 perms[3] = {band_row_perms[0][perm0], band_row_perms[1][perm1], band_row_perms[2][perm2]};
+                    u8 *rows = row_orders[n_row_orders++];
+                    for (u32 i = 0; i < 9; i++)
+                        rows[i] = (u8) (perms3[band_perm][i / 3] * 3 + perms3[perms[i / 3]][i % 3]);
+                }
+            }
+        }
+    }
+    
+    // among the transforms with the smallest pattern the smallest digits win
+    u8 best_digits[81];
+    bool have_best = false;
+    
+    for (u32 candidate_idx = 0; candidate_idx < n_candidates; candidate_idx++) {
+        for (u32 order_idx = 0; order_idx < n_row_orders; order_idx++) {
+            struct grid_transform candidate = candidates[candidate_idx];
+            for (u32 i = 0; i < 9; i++)
+                candidate.rows[i] = candidates[candidate_idx].rows[row_orders[order_idx][i]];
+            
+            memset(candidate.digit_map, 0, sizeof(candidate.digit_map));
+            u8 next_digit = 1;
+            u32 given_idx = 0;
+            
+            // 0 while the digits so far equal the best ones, then -1 or 1
+            int order = have_best ? 0 : -1;
+            
+            for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+                u32 value = transformed_value(puzzle, candidate.transposed, candidate.rows[cell_idx / 9], candidate.cols[cell_idx % 9]);
+                if (value == 0)
+                    continue;
+                
+                if (candidate.digit_map[value] == 0)
+                    candidate.digit_map[value] = next_digit++;
+                u8 digit = candidate.digit_map[value];
+                
+                if (order == 0 && digit != best_digits[given_idx]) {
+                    order = digit < best_digits[given_idx] ? -1 : 1;
+                    if (order > 0)
+                        break;
+                }
+                
+                if (order < 0)
+                    best_digits[given_idx] = digit;
+                given_idx++;
+            }
+            
+            if (order >= 0)
+                continue;
+            
+            // digits that are not given still need a place in the map, in increasing order
+            for (u32 value = 1; value <= 9; value++) {
+                if (candidate.digit_map[value] == 0)
+                    candidate.digit_map[value] = next_digit++;
+            }
+            
+            *transform = candidate;
+            have_best = true;
+        }
+    }
+    
+    for (u32 row = 0; row < 9; row++) {
+        for (u32 col = 0; col < 9; col++) {
+            u32 value = transformed_value(puzzle, transform->transposed, transform->rows[row], transform->cols[col]);
+            canonical->values[row][col] = transform->digit_map[value];
+        }
+    }
+    
+    return true;
+}
+
+// the 81 values of a grid, 2 to a byte
+#define PACKED_GRID_SIZE 41
+
+static void pack_grid(const struct sudoku_grid *grid, u8 packed[PACKED_GRID_SIZE]) {
+    memset(packed, 0, PACKED_GRID_SIZE);
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        packed[cell_idx / 2] |= (u8) (grid->values[cell_idx / 9][cell_idx % 9] << (cell_idx % 2 * 4));
+}
+
+static void unpack_grid(const u8 packed[PACKED_GRID_SIZE], struct sudoku_grid *grid) {
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        grid->values[cell_idx / 9][cell_idx % 9] = (packed[cell_idx / 2] >> (cell_idx % 2 * 4)) & 15;
+}
+
+// fnv-1a
+static u64 hash_packed_grid(const u8 packed[PACKED_GRID_SIZE]) {
+    u64 hash = 14695981039346656037ull;
+    for (u32 i = 0; i < PACKED_GRID_SIZE; i++) {
+        hash ^= packed[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// a puzzle looked up in the cache, kept by the caller to store its solution after a miss
+struct cache_probe {
+    // false for a puzzle that canonicalize turned down, it is neither looked up nor stored
+    bool cached;
+    struct grid_transform transform;
+    u8 key[PACKED_GRID_SIZE];
+    u64 hash;
+};
+
+#define CACHE_NIL UINT32_MAX
+
+struct cache_entry {
+    u8 key[PACKED_GRID_SIZE];
+    
+    // in canonical form
+    u8 solution[PACKED_GRID_SIZE];
+    
+    // the solutions found and the number the search stopped at, 1 for a plain solve and UINT64_MAX
+    // for counting without a cap, a count below the cap is the exact count
+    u64 n_solutions;
+    u64 solution_cap;
+    
+    u64 hash;
+    u32 hash_next;
+    
+    // most recently used first
+    u32 lru_prev;
+    u32 lru_next;
+};
+
+// an lru map from canonical puzzles to their solutions, every entry is allocated up front
+// a lock makes it safe to share between the batch workers, canonicalizing happens outside of it
+struct solution_cache {
+    mtx_t lock;
+    
+    struct cache_entry *entries;
+    u32 capacity;
+    u32 n_entries;
+    
+    u32 *buckets;
+    u32 bucket_mask;
+    
+    u32 lru_head;
+    u32 lru_tail;
+    
+    u64 hits;
+    u64 misses;
+};
+
+void solution_cache_init(struct solution_cache *cache, u32 capacity) {
+    assert(capacity > 0);
+    
+    u32 n_buckets = 1;
+    while (n_buckets < capacity)
+        n_buckets *= 2;
+    
+    cache->entries = malloc(capacity * sizeof(cache->entries[0]));
+    cache->buckets = malloc(n_buckets * sizeof(cache->buckets[0]));
+    if (!cache->entries || !cache->buckets || mtx_init(&cache->lock, mtx_plain) != thrd_success) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    for (u32 i = 0; i < n_buckets; i++)
+        cache->buckets[i] = CACHE_NIL;
+    
+    cache->capacity = capacity;
+    cache->n_entries = 0;
+    cache->bucket_mask = n_buckets - 1;
+    cache->lru_head = CACHE_NIL;
+    cache->lru_tail = CACHE_NIL;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void solution_cache_free(struct solution_cache *cache) {
+    mtx_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->buckets);
+}
+
+// the number of solutions a solve with options stops at
+static u64 options_solution_cap(const struct sudoku_solve_options *options) {
+    if (!options->count_solutions)
+        return 1;
+    return options->solution_cap ? options->solution_cap : UINT64_MAX;
+}
+
+static void lru_unlink(struct solution_cache *cache, u32 entry_idx) {
+    struct cache_entry *entry = &cache->entries[entry_idx];
+    
+    if (entry->lru_prev != CACHE_NIL)
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+    
+    if (entry->lru_next != CACHE_NIL)
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(struct solution_cache *cache, u32 entry_idx) {
+    struct cache_entry *entry = &cache->entries[entry_idx];
+    entry->lru_prev = CACHE_NIL;
+    entry->lru_next = cache->lru_head;
+    
+    if (cache->lru_head != CACHE_NIL)
+        cache->entries[cache->lru_head].lru_prev = entry_idx;
+    else
+        cache->lru_tail = entry_idx;
+    cache->lru_head = entry_idx;
+}
+
+static u32 cache_find(const struct solution_cache *cache, const u8 key[PACKED_GRID_SIZE], u64 hash) {
+    u32 entry_idx = cache->buckets[hash & cache->bucket_mask];
+    while (entry_idx != CACHE_NIL) {
+        const struct cache_entry *entry = &cache->entries[entry_idx];
+        if (entry->hash == hash && memcmp(entry->key, key, PACKED_GRID_SIZE) == 0)
+            return entry_idx;
+        entry_idx = entry->hash_next;
+    }
+    return CACHE_NIL;
+}
+
+// canonicalizes puzzle into probe and looks it up, on a hit the solution is mapped back into into
+// and the number of solutions is returned, on a miss UINT64_MAX is returned
+u64 solution_cache_lookup(struct solution_cache *cache, const struct sudoku_solve_options *options, const struct sudoku_grid *puzzle,
+                          struct sudoku_grid *into, struct cache_probe *probe) {
+    struct sudoku_grid canonical;
+    probe->cached = canonicalize(puzzle, &canonical, &probe->transform);
+    if (!probe->cached)
+        return UINT64_MAX;
+    
+    pack_grid(&canonical, probe->key);
+    probe->hash = hash_packed_grid(probe->key);
+    
+    u64 cap = options_solution_cap(options);
+    u8 packed_solution[PACKED_GRID_SIZE];
+    u64 n_solutions = UINT64_MAX;
+    
+    mtx_lock(&cache->lock);
+    
+    u32 entry_idx = cache_find(cache, probe->key, probe->hash);
+    if (entry_idx != CACHE_NIL) {
+        struct cache_entry *entry = &cache->entries[entry_idx];
+        
+        // a count is good for this solve if it is exact or was stopped at a cap at least as high
+        if (entry->n_solutions < entry->solution_cap || entry->solution_cap >= cap) {
+            n_solutions = entry->n_solutions < cap ? entry->n_solutions : cap;
+            memcpy(packed_solution, entry->solution, PACKED_GRID_SIZE);
+            lru_unlink(cache, entry_idx);
+            lru_push_front(cache, entry_idx);
+        }
+    }
+    
+    if (n_solutions != UINT64_MAX)
+        cache->hits++;
+    else
+        cache->misses++;
+    
+    mtx_unlock(&cache->lock);
+    
+    if (n_solutions == UINT64_MAX || n_solutions == 0)
+        return n_solutions;
+    
+    // the inverse of the transform
+    struct sudoku_grid canonical_solution;
+    unpack_grid(packed_solution, &canonical_solution);
+    
+    u8 values[10] = {0};
+    for (u32 value = 1; value <= 9; value++)
+        values[probe->transform.digit_map[value]] = (u8) value;
+    
+    for (u32 row = 0; row < 9; row++) {
+        for (u32 col = 0; col < 9; col++) {
+            u32 source_row = probe->transform.rows[row];
+            u32 source_col = probe->transform.cols[col];
+            u32 value = values[canonical_solution.values[row][col]];
+            
+            if (probe->transform.transposed)
+                into->values[source_col][source_row] = value;
+            else
+                into->values[source_row][source_col] = value;
+        }
+    }
+    
+    return n_solutions;
+}
+
+// adds a canonical puzzle and its canonical solution, called with the lock held
+static void cache_insert(struct solution_cache *cache, const u8 key[PACKED_GRID_SIZE], u64 hash,
+                         const u8 solution[PACKED_GRID_SIZE], u64 n_solutions, u64 solution_cap) {
+    u32 entry_idx = cache_find(cache, key, hash);
+    if (entry_idx != CACHE_NIL) {
+        // another worker solved the same form, the count that says more is kept
+        struct cache_entry *entry = &cache->entries[entry_idx];
+        if (entry->n_solutions >= entry->solution_cap && solution_cap > entry->solution_cap) {
+            memcpy(entry->solution, solution, PACKED_GRID_SIZE);
+            entry->n_solutions = n_solutions;
+            entry->solution_cap = solution_cap;
+        }
+        
+        lru_unlink(cache, entry_idx);
+        lru_push_front(cache, entry_idx);
+        return;
+    }
+    
+    if (cache->n_entries < cache->capacity) {
+        entry_idx = cache->n_entries++;
+    } else {
+        // the least recently used entry makes room
+        entry_idx = cache->lru_tail;
+        lru_unlink(cache, entry_idx);
+        
+        u32 *link = &cache->buckets[cache->entries[entry_idx].hash & cache->bucket_mask];
+        while (*link != entry_idx)
+            link = &cache->entries[*link].hash_next;
+        *link = cache->entries[entry_idx].hash_next;
+    }
+    
+    struct cache_entry *entry = &cache->entries[entry_idx];
+    memcpy(entry->key, key, PACKED_GRID_SIZE);
+    memcpy(entry->solution, solution, PACKED_GRID_SIZE);
+    entry->n_solutions = n_solutions;
+    entry->solution_cap = solution_cap;
+    entry->hash = hash;
+    
+    u32 *bucket = &cache->buckets[hash & cache->bucket_mask];
+    entry->hash_next = *bucket;
+    *bucket = entry_idx;
+    lru_push_front(cache, entry_idx);
+}
+
+// stores the solution of the puzzle behind probe, in canonical form
+// a puzzle that timed out is not stored, a bigger budget may well finish it
+void solution_cache_store(struct solution_cache *cache, const struct sudoku_solve_options *options, const struct cache_probe *probe,
+                          const struct sudoku_grid *solution, u64 n_solutions) {
+    if (!probe->cached || n_solutions == SUDOKU_TIMED_OUT)
+        return;
+    
+    u8 packed_solution[PACKED_GRID_SIZE] = {0};
+    if (n_solutions > 0) {
+        struct sudoku_grid canonical_solution;
+        for (u32 row = 0; row < 9; row++) {
+            for (u32 col = 0; col < 9; col++) {
+                u32 value = transformed_value(solution, probe->transform.transposed, probe->transform.rows[row], probe->transform.cols[col]);
+                canonical_solution.values[row][col] = probe->transform.digit_map[value];
+            }
+        }
+        pack_grid(&canonical_solution, packed_solution);
+    }
+    
+    mtx_lock(&cache->lock);
+    cache_insert(cache, probe->key, probe->hash, packed_solution, n_solutions, options_solution_cap(options));
+    mtx_unlock(&cache->lock);
+}
+
+// ---------------------------------------------------------------------------
+// multi-threaded batch solving
+//
+// every worker starts with an equal, contiguous slice of the puzzles and takes puzzles off the
+// front of it, a worker that runs out steals the back half of another worker's slice
+// a slice is a [begin, end) pair packed in one atomic u64 so taking and stealing are single CASes
+// each puzzle's solution and verification are written to its own slot, so results stay in input order
+// every worker lives in its own caller provided workspace, which also keeps their ranges off the
+// same cache line
+// ---------------------------------------------------------------------------
+
+struct batch;
+
+struct batch_worker {
+    // begin in the low 32 bits, end in the high 32 bits
+    _Atomic u64 range;
+    
+    u32 worker_idx;
+    struct batch *batch;
+    struct sudoku_solve_stats stats;
+    thrd_t thread;
+    bool started;
+    
+    struct solve_workspace workspace;
+};
+
+static_assert(sizeof(struct batch_worker) <= sizeof(struct sudoku_workspace), "a batch worker must fit a workspace");
+static_assert(_Alignof(struct batch_worker) <= _Alignof(struct sudoku_workspace), "a batch worker must fit a workspace");
+
+struct batch {
+    const struct sudoku_solve_options *options;
+    const struct sudoku_grid *initial_states;
+    struct sudoku_grid *solutions;
+    struct is_solved_result *verdicts;
+    u64 *solution_counts;
+    
+    // stats of each puzzle, NULL if only the totals are wanted
+    struct sudoku_solve_stats *puzzle_stats;
+    
+    // NULL if every puzzle is solved
+    struct solution_cache *cache;
+    
+    struct sudoku_workspace *workers;
+    u32 n_workers;
+};
+
+static inline struct batch_worker *batch_worker_at(struct batch *batch, u32 worker_idx) {
+    return (struct batch_worker*) &batch->workers[worker_idx];
+}
+
+static inline u64 pack_range(u32 begin, u32 end) {
+    return (u64) begin | ((u64) end << 32);
+}
+
+// takes up to max_items from the front of range, they are [*first_idx, *first_idx + *n_taken)
+bool range_take(_Atomic u64 *range, u32 max_items, u32 *first_idx, u32 *n_taken) {
+    u64 packed = atomic_load(range);
+    
+    for (;;) {
+        u32 begin = (u32) packed;
+        u32 end = (u32) (packed >> 32);
+        if (begin >= end)
+            return false;
+        
+        u32 n = end - begin < max_items ? end - begin : max_items;
+        if (atomic_compare_exchange_weak(range, &packed, pack_range(begin + n, end))) {
+            *first_idx = begin;
+            *n_taken = n;
+            return true;
+        }
+    }
+}
+
+// moves the back half of victim into thief, which must be empty, returns false if victim is empty
+bool range_steal_half(_Atomic u64 *victim, _Atomic u64 *thief) {
+    u64 packed = atomic_load(victim);
+    
+    for (;;) {
+        u32 begin = (u32) packed;
+        u32 end = (u32) (packed >> 32);
+        if (begin >= end)
+            return false;
+        
+        u32 mid = begin + (end - begin) / 2;
+        if (atomic_compare_exchange_weak(victim, &packed, pack_range(begin, mid))) {
+            // the thief's range is empty so nobody else can be changing it
+            atomic_store(thief, pack_range(mid, end));
+            return true;
+        }
+    }
+}
+
+// moves the back half of some other worker's range into thief's range, returns false if
+// every other worker's range is empty
+bool batch_steal(struct batch_worker *thief) {
+    struct batch *batch = thief->batch;
+    
+    for (u32 i = 1; i < batch->n_workers; i++) {
+        struct batch_worker *victim = batch_worker_at(batch, (thief->worker_idx + i) % batch->n_workers);
+        if (range_steal_half(&victim->range, &thief->range))
+            return true;
+    }
+    
+    return false;
+}
+
+// solves [first_idx, first_idx + n_grids) like batch_worker_main does, except that puzzles found in
+// the cache are not solved and the solutions of the others are added to it
+void batch_solve_cached(struct batch *batch, u32 first_idx, u32 n_grids, bool lockstep,
+                        struct solve_workspace *workspace, struct sudoku_solve_stats *puzzle_stats) {
+    assert(n_grids <= LOCKSTEP_LANES);
+    
+    struct cache_probe probes[LOCKSTEP_LANES];
+    struct sudoku_grid missed_states[LOCKSTEP_LANES];
+    struct sudoku_grid missed_solutions[LOCKSTEP_LANES];
+    u64 missed_counts[LOCKSTEP_LANES];
+    struct sudoku_solve_stats missed_stats[LOCKSTEP_LANES] = {0};
+    u32 missed_idxs[LOCKSTEP_LANES];
+    u32 n_missed = 0;
+    
+    for (u32 i = 0; i < n_grids; i++) {
+        u32 grid_idx = first_idx + i;
+        u64 n_solutions = solution_cache_lookup(batch->cache, batch->options, &batch->initial_states[grid_idx],
+                                                &batch->solutions[grid_idx], &probes[n_missed]);
+        
+        if (n_solutions != UINT64_MAX) {
+            batch->solution_counts[grid_idx] = n_solutions;
+            continue;
+        }
+        
+        missed_states[n_missed] = batch->initial_states[grid_idx];
+        missed_idxs[n_missed++] = i;
+    }
+    
+    if (n_missed == 0)
+        return;
+    
+    if (lockstep) {
+        solve_lockstep(batch->options, missed_states, n_missed, missed_solutions, missed_counts, workspace, missed_stats);
+    } else {
+        for (u32 i = 0; i < n_missed; i++)
+            missed_counts[i] = solve_with_options(batch->options, &missed_states[i], &missed_solutions[i], workspace, &missed_stats[i]);
+    }
+    
+    for (u32 i = 0; i < n_missed; i++) {
+        u32 grid_idx = first_idx + missed_idxs[i];
+        batch->solutions[grid_idx] = missed_solutions[i];
+        batch->solution_counts[grid_idx] = missed_counts[i];
+        puzzle_stats[missed_idxs[i]] = missed_stats[i];
+        
+        solution_cache_store(batch->cache, batch->options, &probes[i], &missed_solutions[i], missed_counts[i]);
+    }
+}
+
+int batch_worker_main(void *arg) {
+    struct batch_worker *worker = arg;
+    struct batch *batch = worker->batch;
+    
+    // without the lockstep kernel the puzzles are solved one at a time
+    bool lockstep = batch->options->lockstep && lockstep_propagate;
+    u32 max_grids = lockstep ? LOCKSTEP_LANES : 1;
+    
+    for (;;) {
+        u32 first_idx, n_taken;
+        
+        if (!range_take(&worker->range, max_grids, &first_idx, &n_taken)) {
+            if (!batch_steal(worker))
+                break;
+            continue;
+        }
+        
+        struct sudoku_solve_stats puzzle_stats[LOCKSTEP_LANES] = {0};
+        
+        if (batch->cache) {
+            batch_solve_cached(batch, first_idx, n_taken, lockstep, &worker->workspace, puzzle_stats);
+        } else if (lockstep) {
+            solve_lockstep(batch->options, &batch->initial_states[first_idx], n_taken, &batch->solutions[first_idx],
+                           &batch->solution_counts[first_idx], &worker->workspace, puzzle_stats);
+        } else {
+            batch->solution_counts[first_idx] = solve_with_options(batch->options, &batch->initial_states[first_idx],
+                                                                   &batch->solutions[first_idx], &worker->workspace, &puzzle_stats[0]);
+        }
+        
+        for (u32 i = 0; i < n_taken; i++) {
+            u32 grid_idx = first_idx + i;
+            
+            // a puzzle without a solution, or that timed out, leaves nothing to verify
+            if (batch->verdicts && batch->solution_counts[grid_idx] > 0 && batch->solution_counts[grid_idx] != SUDOKU_TIMED_OUT)
+                batch->verdicts[grid_idx] = is_solved(&batch->solutions[grid_idx]);
+            
+            if (batch->puzzle_stats)
+                batch->puzzle_stats[grid_idx] = puzzle_stats[i];
+            add_solve_stats(&worker->stats, &puzzle_stats[i]);
+        }
+    }
+    
+    return 0;
+}
+
+// solves and verifies initial_states[0..n_grids) on n_threads threads
+// solutions[i], verdicts[i], solution_counts[i] and puzzle_stats[i] are the result for initial_states[i],
+// verdicts and puzzle_stats may be NULL, verdicts[i] is only set if solution_counts[i] > 0 and the puzzle did not time out
+// puzzles found in cache are not solved, cache may be NULL
+// workspaces is caller provided room for the n_threads workers, nothing is allocated here
+void solve_batch(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_states, u32 n_grids,
+                 struct sudoku_grid *solutions, struct is_solved_result *verdicts, u64 *solution_counts,
+                 struct sudoku_solve_stats *puzzle_stats, struct solution_cache *cache,
+                 struct sudoku_workspace *workspaces, u32 n_threads, struct sudoku_solve_stats *stats) {
+    assert(n_threads >= 1);
+    
+    struct batch batch;
+    batch.options = options;
+    batch.initial_states = initial_states;
+    batch.solutions = solutions;
+    batch.verdicts = verdicts;
+    batch.solution_counts = solution_counts;
+    batch.puzzle_stats = puzzle_stats;
+    batch.cache = cache;
+    batch.workers = workspaces;
+    batch.n_workers = n_threads;
+    
+    for (u32 i = 0; i < n_threads; i++) {
+        struct batch_worker *worker = batch_worker_at(&batch, i);
+        
+        u32 begin = (u32) ((u64) n_grids * i / n_threads);
+        u32 end = (u32) ((u64) n_grids * (i + 1) / n_threads);
+        atomic_init(&worker->range, pack_range(begin, end));
+        
+        worker->worker_idx = i;
+        worker->batch = &batch;
+        memset(&worker->stats, 0, sizeof(worker->stats));
+    }
+    
+    // the calling thread is worker 0, the range of a worker whose thread cannot be created is
+    // simply stolen by the others
+    for (u32 i = 1; i < n_threads; i++) {
+        struct batch_worker *worker = batch_worker_at(&batch, i);
+        worker->started = thrd_create(&worker->thread, batch_worker_main, worker) == thrd_success;
+    }
+    
+    batch_worker_main(batch_worker_at(&batch, 0));
+    
+    for (u32 i = 1; i < n_threads; i++) {
+        struct batch_worker *worker = batch_worker_at(&batch, i);
+        if (worker->started)
+            thrd_join(worker->thread, NULL);
+    }
+    
+    for (u32 i = 0; i < n_threads; i++)
+        add_solve_stats(stats, &batch_worker_at(&batch, i)->stats);
+}
+
+// ---------------------------------------------------------------------------
+// library api
+//
+// the functions declared in sudoku.h, the only symbols libsudoku exports
+// everything after this section is the command line program, left out of the library by -DSUDOKU_LIBRARY
+// ---------------------------------------------------------------------------
+
+static_assert(sizeof(struct solve_workspace) <= sizeof(struct sudoku_workspace), "the engines' state must fit a workspace");
+
+static once_flag library_kernels_once = ONCE_FLAG_INIT;
+
+static void library_select_kernels(void) {
+    select_simd_kernels(KERNEL_AUTO);
+}
+
+// the engines and is_solved index by value, grids coming from outside are checked before reaching them
+// returns the index of the first cell holding something other than 0-9, 81 if there is none
+static u32 first_value_out_of_range(const struct sudoku_grid *grid) {
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        if (grid->values[cell_idx / 9][cell_idx % 9] > 9)
+            return cell_idx;
+    }
+    
+    return 81;
+}
+
+// whether the engines can run with options, the command line refuses the rest before solving
+// and the engines only assert it
+static bool options_supported(const struct sudoku_solve_options *options) {
+    if ((u32) options->engine > SUDOKU_ENGINE_DLX || (u32) options->propagation > SUDOKU_PROPAGATE_PAIRS ||
+        (u32) options->value_order > SUDOKU_VALUE_ORDER_RANDOM || (u32) options->restarts > SUDOKU_RESTART_GEOMETRIC ||
+        (options->requeue && (u32) options->requeue_engine > SUDOKU_ENGINE_DLX))
+        return false;
+    
+    if (options->techniques >> SUDOKU_N_TECHNIQUES)
+        return false;
+    
+    // the collisions engine cannot count, neither at first nor on a retry
+    if (options->count_solutions &&
+        (options->engine == SUDOKU_ENGINE_COLLISIONS || (options->requeue && options->requeue_engine == SUDOKU_ENGINE_COLLISIONS)))
+        return false;
+    
+    return true;
+}
+
+u64 sudoku_solve(const struct sudoku_solve_options *options, const struct sudoku_grid *puzzle, struct sudoku_grid *solution,
+                 struct sudoku_workspace *workspace, struct sudoku_solve_stats *stats) {
+    call_once(&library_kernels_once, library_select_kernels);
+    
+    if (!options_supported(options))
+        return SUDOKU_INVALID_OPTIONS;
+    
+    if (first_value_out_of_range(puzzle) < 81) {
+        *solution = *puzzle;
+        return 0;
+    }
+    
+    struct sudoku_solve_stats local_stats = {0};
+    u64 n_solutions = solve_with_options(options, puzzle, solution, (struct solve_workspace*) workspace, &local_stats);
+    
+    if (stats)
+        add_solve_stats(stats, &local_stats);
+    
+    return n_solutions;
+}
+
+bool sudoku_solve_batch(const struct sudoku_solve_options *options, const struct sudoku_grid *puzzles, u32 n_grids,
+                        struct sudoku_grid *solutions, u64 *solution_counts,
+                        struct sudoku_workspace *workspaces, u32 n_threads, struct sudoku_solve_stats *stats) {
+    call_once(&library_kernels_once, library_select_kernels);
+    
+    if (!options_supported(options) || n_threads == 0)
+        return false;
+    
+    // a puzzle holding anything but 0-9 has no solution, like in sudoku_solve, the runs of puzzles
+    // between such puzzles are solved as batches of their own, which is a single batch normally
+    struct sudoku_solve_stats local_stats = {0};
+    u32 run_start = 0;
+    for (u32 grid_idx = 0; grid_idx <= n_grids; grid_idx++) {
+        if (grid_idx < n_grids && first_value_out_of_range(&puzzles[grid_idx]) == 81)
+            continue;
+        
+        if (grid_idx > run_start) {
+            solve_batch(options, &puzzles[run_start], grid_idx - run_start, &solutions[run_start], NULL,
+                        &solution_counts[run_start], NULL, NULL, workspaces, n_threads, &local_stats);
+        }
+        
+        if (grid_idx < n_grids) {
+            solutions[grid_idx] = puzzles[grid_idx];
+            solution_counts[grid_idx] = 0;
+        }
+        run_start = grid_idx + 1;
+    }
+    
+    if (stats)
+        add_solve_stats(stats, &local_stats);
+    
+    return true;
+}
+
+bool sudoku_verify(const struct sudoku_grid *grid, char *error, size_t error_size) {
+    u32 bad_idx = first_value_out_of_range(grid);
+    if (bad_idx < 81) {
+        if (error && error_size > 0)
+            snprintf(error, error_size, "cell %"PRIu32" holds %"PRIu32", which is not a value",
+                     bad_idx, grid->values[bad_idx / 9][bad_idx % 9]);
+        return false;
+    }
+    
+    struct is_solved_result solved = is_solved(grid);
+    
+    if (!solved.is_solved && error && error_size > 0) {
+        char error_str[ERROR_STR_SIZE];
+        snprintf(error, error_size, "%s", make_error_str(solved, error_str));
+    }
+    
+    return solved.is_solved;
+}
+
+#if !defined(SUDOKU_LIBRARY)
+
+// .ss file looks like
+// ...|85.|..7     line 0
+// 382|...|...          1
+// 9.7|.3.|184          2
+// -----------          3
+// .28|..6|.3.          4
+// 4.9|...|8.1          5
+// .3.|9..|47.          6
+// -----------          7
+// 713|.6.|2.8          8
+// ...|...|516          9
+// 2..|.98|...         10
+void parse_ss_format(const char *contents, struct sudoku_grid *into) {
+    const char *next_char = contents;
+    
+    u32 row_idx = 0;
+    // .ss consists of 11 lines
+    for (u32 line_num = 0; line_num < 11; line_num++) {
+        if (line_num == 3 || line_num == 7) {
+            next_char += 11;
+            
+        } else {
+            u32 col_idx = 0;
+            for(u32 i=0;i<11;i++) {
+                char c = *next_char++;
+                if (c == '|') {
+                    continue;
+                }
+                if (c == '.') {
+                    into->values[row_idx][col_idx] = 0;
+                } else if (c >= '0' && c <= '9') {
+                    into->values[row_idx][col_idx] = c - '0';
+                } else {
+						fprintf(stderr, "error parsing .ss file: line %d char %d, expected digit but found %c\n", line_num+1, col_idx+1, c);
+				}
+                
+                col_idx++;
+            }
+			row_idx++;
+        }
+
+		// skip all whitespace
+		while (isspace(*next_char))
+			next_char++;
+    }
+}
+
+// populates into with the contents from sudoku file filename
+void load_grid_from_file(const char *file_name, struct sudoku_grid *into) {
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL) {
+        perror(file_name);
+        exit(1);
+    }
+    
+    
+    char file_contents[4096];
+    size_t n_read = fread(file_contents, 1, 4096, fp);
+    fclose(fp);
+	file_contents[n_read] = 0;
+    
+    size_t file_name_len = strlen(file_name);
+    
+    if (strcmp(&file_name[file_name_len-3], ".ss") == 0) {
+        
+        parse_ss_format(file_contents, into);
+        
+        
+    } else {
+        printf("%s: file format not supported\n", file_name);
+        exit(1);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// .sdb binary collections
+//
+// a .sdb file is a 32 byte header, one record per puzzle and an index, all little endian
+//   header: "SDB1", u32 version (1), u64 number of puzzles, u64 offset of the index,
+//           u32 index stride, u32 reserved (0)
+//   record: an 81 bit mask of the cells that are given (bit i is cell i, 11 bytes), then the
+//           given values 4 bits each, low nibble first, padded to a whole byte
+//   index:  the offset of every stride-th record, so any puzzle is at most stride - 1 records
+//           away from a known offset
+// a typical 17-30 clue puzzle takes 20-26 bytes instead of the 82 of a .sdm line, and decoding it
+// is a handful of bit operations per given instead of a parse of 81 characters
+// ---------------------------------------------------------------------------
+
+#define SDB_MAGIC "SDB1"
+#define SDB_VERSION 1
+#define SDB_HEADER_SIZE 32
+#define SDB_INDEX_STRIDE 4096
+
+#define SDB_MASK_SIZE 11
+#define SDB_MAX_RECORD_SIZE (SDB_MASK_SIZE + 41)
+
+static inline u64 read_le(const u8 *bytes, u32 n_bytes) {
+    u64 value = 0;
+    for (u32 i = 0; i < n_bytes; i++)
+        value |= (u64) bytes[i] << (8 * i);
+    return value;
+}
+
+static inline void write_le(u8 *bytes, u64 value, u32 n_bytes) {
+    for (u32 i = 0; i < n_bytes; i++)
+        bytes[i] = (u8) (value >> (8 * i));
+}
+
+// the size of the record starting with the given mask
+static inline u32 sdb_record_size(const u8 mask[SDB_MASK_SIZE]) {
+    u32 n_givens = popcount32((u32) read_le(mask, 4)) + popcount32((u32) read_le(mask + 4, 4)) +
+                   popcount32((u32) read_le(mask + 8, 3));
+    return SDB_MASK_SIZE + (n_givens + 1) / 2;
+}
+
+// writes the record of grid to into, returns its size
+u32 encode_sdb_record(const struct sudoku_grid *grid, u8 into[SDB_MAX_RECORD_SIZE]) {
+    memset(into, 0, SDB_MAX_RECORD_SIZE);
+    
+    u32 n_givens = 0;
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        u32 value = grid->values[cell_idx / 9][cell_idx % 9];
+        if (value == 0)
+            continue;
+        
+        into[cell_idx / 8] |= (u8) (1 << (cell_idx % 8));
+        into[SDB_MASK_SIZE + n_givens / 2] |= (u8) (value << (n_givens % 2 * 4));
+        n_givens++;
+    }
+    
+    return SDB_MASK_SIZE + (n_givens + 1) / 2;
+}
+
+// decodes the record at record into into
+// returns false if a given is not a value, or the mask has bits past the last cell
+bool decode_sdb_record(const u8 *record, struct sudoku_grid *into) {
+    memset(into, 0, sizeof(*into));
+    
+    u64 mask_lo = read_le(record, 8);
+    u64 mask_hi = read_le(record + 8, 3);
+    if (mask_hi >> 17)
+        return false;
+    
+    const u8 *values = record + SDB_MASK_SIZE;
+    u32 given_idx = 0;
+    u32 bad_values = 0;
+    
+    for (u32 half = 0; half < 2; half++) {
+        u64 mask = half ? mask_hi : mask_lo;
+        while (mask) {
+            u32 cell_idx = half * 64 + ctz64(mask);
+            mask &= mask - 1;
+            
+            u32 value = (values[given_idx / 2] >> (given_idx % 2 * 4)) & 15;
+            given_idx++;
+            
+            bad_values |= value == 0 || value > 9;
+            into->values[cell_idx / 9][cell_idx % 9] = value;
+        }
+    }
+    
+    return !bad_values;
+}
+
+// ---------------------------------------------------------------------------
+// streaming .sdm reader
+//
+// a .sdm file is one puzzle per line, 81 characters of '0'-'9' or '.'
+// puzzles are parsed lazily as the solver asks for them, so memory use does not depend on
+// the number of puzzles in the file
+// input that starts with the .sdb header is read as a .sdb collection instead, whatever its name
+// regular files are mmapped where that is available, everything else (stdin, pipes, or a
+// failed mmap) is read through a fixed size buffer that is refilled as it drains
+// ---------------------------------------------------------------------------
+
+#define SDM_CHUNK_SIZE 65536
+
+struct sdm_reader {
+    FILE *fp;
+    
+    // what error messages call the input
+    const char *file_name;
+    
+    // the bytes currently available to the parser, either the whole mmapped file or chunk
+    const char *data;
+    size_t len;
+    size_t pos;
+    
+    bool is_mapped;
+    bool at_eof;
+    
+    // number of puzzles parsed so far, and of the line breaks before the last one, for error messages
+    u64 n_parsed;
+    u64 n_line_breaks;
+    
+    // set for .sdb input, whose records end where the index starts
+    bool is_binary;
+    u64 n_puzzles;
+    u64 index_offset;
+    u32 index_stride;
+    
+    char chunk[SDM_CHUNK_SIZE];
+};
+
+void sdm_reader_fill(struct sdm_reader *reader, size_t n);
+
+// opens file_name for reading, "-" reads from stdin
+void sdm_reader_open(struct sdm_reader *reader, const char *file_name) {
+    memset(reader, 0, offsetof(struct sdm_reader, chunk));
+    
+    if (strcmp(file_name, "-") == 0) {
+        reader->fp = stdin;
+        reader->file_name = "stdin";
+    } else {
+        reader->fp = fopen(file_name, "rb");
+        if (reader->fp == NULL) {
+            perror(file_name);
+            exit(1);
+        }
+        reader->file_name = file_name;
+    }
+    
+#if !defined(_WIN32)
+    struct stat st;
+    int fd = fileno(reader->fp);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *mapped = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, (size_t) st.st_size, MADV_SEQUENTIAL);
+            reader->data = mapped;
+            reader->len = (size_t) st.st_size;
+            reader->is_mapped = true;
+            reader->at_eof = true;
+        }
+    }
+#endif
+    
+    if (!reader->is_mapped)
+        reader->data = reader->chunk;
+    
+    sdm_reader_fill(reader, SDB_HEADER_SIZE);
+    if (reader->len - reader->pos >= SDB_HEADER_SIZE && memcmp(reader->data, SDB_MAGIC, 4) == 0) {
+        const u8 *header = (const u8*) reader->data;
+        
+        reader->is_binary = true;
+        reader->n_puzzles = read_le(header + 8, 8);
+        reader->index_offset = read_le(header + 16, 8);
+        reader->index_stride = (u32) read_le(header + 24, 4);
+        
+        if (read_le(header + 4, 4) != SDB_VERSION || reader->index_stride == 0 || reader->index_offset < SDB_HEADER_SIZE) {
+            printf("%s: unsupported .sdb header\n", reader->file_name);
+            exit(1);
+        }
+        
+        reader->pos = SDB_HEADER_SIZE;
+    }
+}
+
+void sdm_reader_close(struct sdm_reader *reader) {
+#if !defined(_WIN32)
+    if (reader->is_mapped)
+        munmap((void *) reader->data, reader->len);
+#endif
+    
+    if (reader->fp != stdin)
+        fclose(reader->fp);
+}
+
+// makes sure at least n bytes are available after pos unless the input ends first
+void sdm_reader_fill(struct sdm_reader *reader, size_t n) {
+    assert(n <= SDM_CHUNK_SIZE);
+    
+    if (reader->at_eof || reader->len - reader->pos >= n)
+        return;
+    
+    // keep the unparsed tail, it is at most one partial line
+    size_t remaining = reader->len - reader->pos;
+    memmove(reader->chunk, reader->chunk + reader->pos, remaining);
+    reader->pos = 0;
+    reader->len = remaining;
+    
+    while (reader->len < SDM_CHUNK_SIZE && !reader->at_eof) {
+        size_t n_read = fread(reader->chunk + reader->len, 1, SDM_CHUNK_SIZE - reader->len, reader->fp);
+        reader->len += n_read;
+        if (n_read == 0)
+            reader->at_eof = true;
+    }
+}
+
+// the line the cells returned last are on, counting from 1
+static u64 sdm_reader_line(const struct sdm_reader *reader) {
+    return reader->n_line_breaks + 1;
+}
+
+// writes ch into into as it should appear in an error message, quoted or as an escape
+static const char *printable_char(char ch, char into[8]) {
+    switch (ch) {
+        case '\n': return "'\\n'";
+        case '\r': return "'\\r'";
+        case '\t': return "'\\t'";
+    }
+    
+    if (isprint((unsigned char) ch))
+        snprintf(into, 8, "'%c'", ch);
+    else
+        snprintf(into, 8, "0x%02x", (unsigned char) ch);
+    return into;
+}
+
+// exits with the length of the current line, length characters of which are before pos
+static void sdm_reader_exit_line_length(struct sdm_reader *reader, u32 n_cells, size_t length) {
+    for (;;) {
+        sdm_reader_fill(reader, 1);
+        if (reader->pos == reader->len || reader->data[reader->pos] == '\n' || reader->data[reader->pos] == '\r')
+            break;
+        reader->pos++;
+        length++;
+    }
+    
+    printf("%s line %"PRIu64": expected %"PRIu32" cells but the line has %zu\n", reader->file_name, sdm_reader_line(reader), n_cells, length);
+    exit(1);
+}
+
+// returns the next n_cells characters of the input, skipping the whitespace in front of them,
+// or NULL once the input is exhausted, the characters stay valid until the next call
+// exits unless they are a line of their own, give or take blanks
+const char *sdm_reader_next_cells(struct sdm_reader *reader, u32 n_cells) {
+    // skip all whitespace, but the previous cells have to be the last thing on their line
+    size_t line_length = reader->n_parsed > 0 ? n_cells : 0;
+    bool ended_line = reader->n_parsed == 0;
+    for (;;) {
+        sdm_reader_fill(reader, 1);
+        if (reader->pos == reader->len)
+            return NULL;
+        
+        char ch = reader->data[reader->pos];
+        if (ch == '\n' || ch == '\r') {
+            ended_line = true;
+        } else if (!isspace((unsigned char) ch)) {
+            break;
+        }
+        
+        if (ch == '\n')
+            reader->n_line_breaks++;
+        line_length++;
+        reader->pos++;
+    }
+    
+    if (!ended_line)
+        sdm_reader_exit_line_length(reader, n_cells, line_length);
+    
+    // one more to see what follows the cells
+    sdm_reader_fill(reader, n_cells + 1);
+    reader->n_parsed++;
+    
+    const char *cells = &reader->data[reader->pos];
+    size_t available = reader->len - reader->pos;
+    size_t length = 0;
+    while (length < n_cells && length < available && cells[length] != '\n' && cells[length] != '\r')
+        length++;
+    
+    if (length < n_cells || (available > n_cells && !isspace((unsigned char) cells[n_cells]))) {
+        reader->pos += length;
+        sdm_reader_exit_line_length(reader, n_cells, length);
+    }
+    
+    reader->pos += n_cells;
+    return cells;
+}
+
+// parses the 81 characters of a .sdm line into into
+// returns the index of the first character that is not a value or '.', 81 if there is none
+u32 parse_sdm_cells(const char *cells, struct sudoku_grid *into) {
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        char ch = cells[cell_idx];
+        
+        if (ch == '.') {
+            into->values[cell_idx / 9][cell_idx % 9] = 0;
+        } else if (ch >= '0' && ch <= '9') {
+            into->values[cell_idx / 9][cell_idx % 9] = ch - '0';
+        } else {
+            return cell_idx;
+        }
+    }
+    
+    return 81;
+}
+
+// decodes the next record of a .sdb collection into into, returns false after the last one
+bool sdb_reader_next(struct sdm_reader *reader, struct sudoku_grid *into) {
+    if (reader->n_parsed == reader->n_puzzles)
+        return false;
+    reader->n_parsed++;
+    
+    sdm_reader_fill(reader, SDB_MASK_SIZE);
+    u32 record_size = reader->len - reader->pos >= SDB_MASK_SIZE ? sdb_record_size((const u8*) &reader->data[reader->pos]) : 0;
+    sdm_reader_fill(reader, record_size);
+    
+    if (record_size == 0 || reader->len - reader->pos < record_size) {
+        printf("%s puzzle %"PRIu64": the .sdb file ends in the middle of its record\n", reader->file_name, reader->n_parsed);
+        exit(1);
+    }
+    
+    if (!decode_sdb_record((const u8*) &reader->data[reader->pos], into)) {
+        printf("%s puzzle %"PRIu64": the .sdb record is corrupt\n", reader->file_name, reader->n_parsed);
+        exit(1);
+    }
+    
+    reader->pos += record_size;
+    return true;
+}
+
+// parses the next puzzle into into, returns false once the input is exhausted
+bool sdm_reader_next(struct sdm_reader *reader, struct sudoku_grid *into) {
+    if (reader->is_binary)
+        return sdb_reader_next(reader, into);
+    
+    const char *cells = sdm_reader_next_cells(reader, 81);
+    if (cells == NULL)
+        return false;
+    
+    u32 bad_idx = parse_sdm_cells(cells, into);
+    if (bad_idx < 81) {
+        char found[8];
+        printf("%s line %"PRIu64", col %"PRIu32": expected number but found %s\n", reader->file_name, sdm_reader_line(reader),
+               bad_idx + 1, printable_char(cells[bad_idx], found));
+        exit(1);
+    }
+    
+    return true;
+}
+
+// parses up to max_grids puzzles into into, returns how many were read
+u32 sdm_reader_next_batch(struct sdm_reader *reader, struct sudoku_grid *into, u32 max_grids) {
+    u32 n_grids = 0;
+    while (n_grids < max_grids && sdm_reader_next(reader, &into[n_grids]))
+        n_grids++;
+    return n_grids;
+}
+
+// makes puzzle puzzle_idx (0 based) the next one read, returns false if the input has fewer puzzles
+// a mapped .sdb file starts from the index entry before it, anything else is read up to it
+bool sdm_reader_seek(struct sdm_reader *reader, u64 puzzle_idx) {
+    u64 entry = reader->is_binary ? puzzle_idx / reader->index_stride : 0;
+    
+    // the index is only worth reading when it skips records
+    if (reader->is_binary && reader->is_mapped && puzzle_idx < reader->n_puzzles && entry * reader->index_stride > reader->n_parsed) {
+        u64 entry_offset = reader->index_offset + entry * 8;
+        
+        if (entry_offset + 8 > reader->len) {
+            printf("%s: the .sdb index is cut short\n", reader->file_name);
+            exit(1);
+        }
+        
+        u64 offset = read_le((const u8*) &reader->data[entry_offset], 8);
+        if (offset < SDB_HEADER_SIZE || offset > reader->index_offset) {
+            printf("%s: the .sdb index is corrupt\n", reader->file_name);
+            exit(1);
+        }
+        
+        reader->pos = (size_t) offset;
+        reader->n_parsed = entry * reader->index_stride;
+    }
+    
+    struct sudoku_grid skipped;
+    while (reader->n_parsed < puzzle_idx) {
+        if (!sdm_reader_next(reader, &skipped))
+            return false;
+    }
+    
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// collection conversion
+//
+// -x rewrites a .ss, .sdm or .sdb file as any of the three, a .ss file holds a single puzzle
+// ---------------------------------------------------------------------------
+
+struct sdb_writer {
+    FILE *fp;
+    u64 n_puzzles;
+    u64 offset;
+    
+    // the offset of every SDB_INDEX_STRIDE-th record
+    u64 *index;
+    u64 index_len;
+    u64 index_capacity;
+};
+
+void sdb_writer_open(struct sdb_writer *writer, const char *file_name) {
+    writer->fp = fopen(file_name, "wb");
+    if (writer->fp == NULL) {
+        perror("fopen: ");
+        exit(1);
+    }
+    
+    writer->n_puzzles = 0;
+    writer->offset = SDB_HEADER_SIZE;
+    writer->index_len = 0;
+    writer->index_capacity = 1024;
+    writer->index = malloc(writer->index_capacity * sizeof(writer->index[0]));
+    if (!writer->index) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    // the header is written last, once the counts are known
+    u8 header[SDB_HEADER_SIZE] = {0};
+    fwrite(header, 1, SDB_HEADER_SIZE, writer->fp);
+}
+
+void sdb_writer_write(struct sdb_writer *writer, const struct sudoku_grid *grid) {
+    if (writer->n_puzzles % SDB_INDEX_STRIDE == 0) {
+        if (writer->index_len == writer->index_capacity) {
+            writer->index_capacity *= 2;
+            writer->index = realloc(writer->index, writer->index_capacity * sizeof(writer->index[0]));
+            if (!writer->index) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+        writer->index[writer->index_len++] = writer->offset;
+    }
+    
+    u8 record[SDB_MAX_RECORD_SIZE];
+    u32 record_size = encode_sdb_record(grid, record);
+    fwrite(record, 1, record_size, writer->fp);
+    
+    writer->offset += record_size;
+    writer->n_puzzles++;
+}
+
+// writes the index and the header, returns the size of the file
+u64 sdb_writer_close(struct sdb_writer *writer) {
+    for (u64 i = 0; i < writer->index_len; i++) {
+        u8 entry[8];
+        write_le(entry, writer->index[i], 8);
+        fwrite(entry, 1, 8, writer->fp);
+    }
+    
+    u8 header[SDB_HEADER_SIZE] = {0};
+    memcpy(header, SDB_MAGIC, 4);
+    write_le(header + 4, SDB_VERSION, 4);
+    write_le(header + 8, writer->n_puzzles, 8);
+    write_le(header + 16, writer->offset, 8);
+    write_le(header + 24, SDB_INDEX_STRIDE, 4);
+    
+    if (fseek(writer->fp, 0, SEEK_SET) != 0 || fwrite(header, 1, SDB_HEADER_SIZE, writer->fp) != SDB_HEADER_SIZE || fclose(writer->fp) != 0) {
+        perror("writing the .sdb file: ");
+        exit(1);
+    }
+    
+    free(writer->index);
+    return writer->offset + writer->index_len * 8;
+}
+
+void write_sdm_line(FILE *fp, const struct sudoku_grid *grid) {
+    char line[82];
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        u32 value = grid->values[cell_idx / 9][cell_idx % 9];
+        line[cell_idx] = value ? (char) ('0' + value) : '.';
+    }
+    line[81] = '\n';
+    fwrite(line, 1, sizeof(line), fp);
+}
+
+// the layout parse_ss_format reads
+void write_ss_format(FILE *fp, const struct sudoku_grid *grid) {
+    for (u32 row = 0; row < 9; row++) {
+        if (row == 3 || row == 6)
+            fputs("-----------\n", fp);
+        
+        for (u32 col = 0; col < 9; col++) {
+            if (col == 3 || col == 6)
+                fputc('|', fp);
+            u32 value = grid->values[row][col];
+            fputc(value ? (int) ('0' + value) : '.', fp);
+        }
+        fputc('\n', fp);
+    }
+}
+
+static bool has_extension(const char *file_name, const char *extension) {
+    size_t name_len = strlen(file_name);
+    size_t extension_len = strlen(extension);
+    return name_len >= extension_len && strcmp(&file_name[name_len - extension_len], extension) == 0;
+}
+
+// .sd16 and .sd25 files hold 16x16 and 25x25 puzzles one per line like .sdm, for -g 16 and -g 25 only
+// returns the side of their grids, 0 for any other file
+static u32 large_grid_side(const char *file_name) {
+    if (has_extension(file_name, ".sd16"))
+        return 16;
+    if (has_extension(file_name, ".sd25"))
+        return 25;
+    return 0;
+}
+
+// writes puzzles [first, first + count) of in_name to out_name in the format its extension names,
+// count 0 means all of them, returns the number of puzzles written
+u64 convert_collection(const char *in_name, const char *out_name, u64 first, u64 count) {
+    bool to_sdb = has_extension(out_name, ".sdb");
+    bool to_ss = has_extension(out_name, ".ss");
+    if (!to_sdb && !to_ss && !has_extension(out_name, ".sdm")) {
+        fprintf(stderr, "-x writes .sdb, .sdm or .ss files\n");
+        exit(1);
+    }
+    
+    struct sdm_reader *reader = NULL;
+    struct sudoku_grid grid;
+    bool have_grid;
+    
+    if (has_extension(in_name, ".ss")) {
+        load_grid_from_file(in_name, &grid);
+        have_grid = first == 0;
+    } else {
+        reader = malloc(sizeof(*reader));
+        if (!reader) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        sdm_reader_open(reader, in_name);
+        have_grid = sdm_reader_seek(reader, first) && sdm_reader_next(reader, &grid);
+    }
+    
+    struct sdb_writer sdb;
+    FILE *fp = NULL;
+    if (to_sdb) {
+        sdb_writer_open(&sdb, out_name);
+    } else {
+        fp = fopen(out_name, "w");
+        if (fp == NULL) {
+            perror("fopen: ");
+            exit(1);
+        }
+    }
+    
+    u64 n_written = 0;
+    while (have_grid && (count == 0 || n_written < count)) {
+        if (to_ss && n_written == 1) {
+            fprintf(stderr, "a .ss file holds a single puzzle, use -N 1 to pick one\n");
+            exit(1);
+        }
+        
+        if (to_sdb)
+            sdb_writer_write(&sdb, &grid);
+        else if (to_ss)
+            write_ss_format(fp, &grid);
+        else
+            write_sdm_line(fp, &grid);
+        n_written++;
+        
+        have_grid = reader && sdm_reader_next(reader, &grid);
+    }
+    
+    if (to_sdb) {
+        sdb_writer_close(&sdb);
+    } else if (fclose(fp) != 0) {
+        perror("fclose: ");
+        exit(1);
+    }
+    
+    if (reader) {
+        sdm_reader_close(reader);
+        free(reader);
+    }
+    
+    return n_written;
+}
+
+// ---------------------------------------------------------------------------
+// solution cache files
+//
+// -P keeps the solution cache in a text file across runs
+// ---------------------------------------------------------------------------
+
+// the size of a cache that only -P asked for
+#define SOLUTION_CACHE_DEFAULT_ENTRIES 65536
+
+static void write_packed_grid(FILE *fp, const u8 packed[PACKED_GRID_SIZE]) {
+    char line[82];
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++) {
+        u32 value = (packed[cell_idx / 2] >> (cell_idx % 2 * 4)) & 15;
+        line[cell_idx] = value ? (char) ('0' + value) : '.';
+    }
+    line[81] = 0;
+    fputs(line, fp);
+}
+
+// writes the entries, least recently used first, one per line: the canonical puzzle, its canonical
+// solution ('-' if it has none), the number of solutions and the cap the count stopped at
+void solution_cache_save(struct solution_cache *cache, const char *file_name) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL) {
+        perror("fopen: ");
+        exit(1);
+    }
+    
+    mtx_lock(&cache->lock);
+    for (u32 entry_idx = cache->lru_tail; entry_idx != CACHE_NIL; entry_idx = cache->entries[entry_idx].lru_prev) {
+        const struct cache_entry *entry = &cache->entries[entry_idx];
+        
+        write_packed_grid(fp, entry->key);
+        fputc(' ', fp);
+        if (entry->n_solutions > 0)
+            write_packed_grid(fp, entry->solution);
+        else
+            fputc('-', fp);
+        fprintf(fp, " %"PRIu64" %"PRIu64"\n", entry->n_solutions, entry->solution_cap);
+    }
+    mtx_unlock(&cache->lock);
+    
+    fclose(fp);
+}
+
+// adds the entries saved by solution_cache_save, a file that does not exist yet is an empty cache
+// returns the number of entries read
+u64 solution_cache_load(struct solution_cache *cache, const char *file_name) {
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL)
+        return 0;
+    
+    char line[256];
+    u64 line_num = 0;
+    u64 n_loaded = 0;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        line_num++;
+        
+        char key_str[82], solution_str[82];
+        u64 n_solutions, solution_cap;
+        struct sudoku_grid key_grid, solution_grid = {0};
+        
+        if (sscanf(line, "%81s %81s %"SCNu64" %"SCNu64, key_str, solution_str, &n_solutions, &solution_cap) != 4 ||
+            strlen(key_str) != 81 || parse_sdm_cells(key_str, &key_grid) < 81 ||
+            (n_solutions > 0 && (strlen(solution_str) != 81 || parse_sdm_cells(solution_str, &solution_grid) < 81))) {
+            printf("%s line %"PRIu64": not a cache entry\n", file_name, line_num);
+            exit(1);
+        }
+        
+        u8 key[PACKED_GRID_SIZE], solution[PACKED_GRID_SIZE];
+        pack_grid(&key_grid, key);
+        pack_grid(&solution_grid, solution);
+        
+        mtx_lock(&cache->lock);
+        cache_insert(cache, key, hash_packed_grid(key), solution, n_solutions, solution_cap);
+        mtx_unlock(&cache->lock);
+        
+        n_loaded++;
+    }
+    
+    fclose(fp);
+    return n_loaded;
+}
+
+// ---------------------------------------------------------------------------
+// parallel search of one puzzle
+//
+// a single hard puzzle is all search, so instead of spreading puzzles over threads the top of its
+// search tree is: the tree is expanded breadth first until there are a few open subproblems per
+// thread (copies of the bitmask state, with singles propagated), each thread starts with an equal
+// slice of them and steals half of another thread's slice when it runs out, like a batch does
+// the first solution (or the cap being reached when counting) sets a flag every search looks at
+// through its budget, so the other threads stop within a few hundred nodes
+// ---------------------------------------------------------------------------
+
+#define SPLIT_SUBPROBLEMS_PER_THREAD 16
+#define SPLIT_MAX_SUBPROBLEMS 1024
+
+struct split_worker {
+    // begin in the low 32 bits, end in the high 32 bits
+    _Atomic u64 range;
+    
+    u32 worker_idx;
+    struct split_search *search;
+    struct sudoku_solve_stats stats;
+    thrd_t thread;
+    bool started;
+    
+    // the first solution this worker counted, when counting
+    bool has_solution;
+    struct sudoku_grid first_solution;
+    
+    // the worker's budget ran out before its subproblems were done
+    bool timed_out;
+};
+
+struct split_search {
+    const struct sudoku_solve_options *options;
+    const struct bitmask_state *subproblems;
+    struct split_worker *workers;
+    u32 n_workers;
+    
+    // set once the search is over, by the first solution or by the cap being reached
+    atomic_bool done;
+    
+    // solutions counted by every worker, when counting
+    _Atomic u64 n_solutions;
+    
+    // written by the worker that set done, when not counting
+    struct sudoku_grid solution;
+};
+
+static void bitmask_state_to_grid(const struct bitmask_state *state, struct sudoku_grid *into) {
+    for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+        into->values[cell_idx / 9][cell_idx % 9] = state->values[cell_idx];
+}
+
+int split_worker_main(void *arg) {
+    struct split_worker *worker = arg;
+    struct split_search *search = worker->search;
+    const struct sudoku_solve_options *options = search->options;
+    
+#if defined(SUDOKU_STATS)
+    active_stats = &worker->stats;
+#endif
+    
+    // every worker gets the node budget, and they all have about the same deadline
+    search_budget_start(options, worker->stats.nodes, &search->done);
+    
+    struct solution_counter counter;
+    counter.cap = options->solution_cap;
+    counter.n_solutions = 0;
+    counter.shared_solutions = &search->n_solutions;
+    counter.cancel = &search->done;
+    
+    for (;;) {
+        u32 subproblem_idx, n_taken;
+        
+        if (!range_take(&worker->range, 1, &subproblem_idx, &n_taken)) {
+            bool stole = false;
+            for (u32 i = 1; i < search->n_workers && !stole; i++)
+                stole = range_steal_half(&search->workers[(worker->worker_idx + i) % search->n_workers].range, &worker->range);
+            if (!stole)
+                break;
+            continue;
+        }
+        
+        struct bitmask_state state = search->subproblems[subproblem_idx];
+        bool stop;
+        
+        if (options->count_solutions) {
+            stop = bitmask_counting_solve(&state, options, &counter, &worker->stats);
+        } else {
+            stop = bitmask_propagating_solve(&state, options, &worker->stats);
+            
+            // only the first solution is kept, the others were found while it was being written
+            if (stop && !atomic_exchange(&search->done, true))
+                bitmask_state_to_grid(&state, &search->solution);
+        }
+        
+        // being cancelled also exhausts the budget, only running out of it on our own is a timeout
+        if (active_budget.exhausted) {
+            worker->timed_out = !atomic_load(&search->done);
+            break;
+        }
+        
+        if (stop)
+            break;
+    }
+    
+    if (counter.n_solutions > 0) {
+        worker->has_solution = true;
+        worker->first_solution = counter.first_solution;
+    }
+    
+    return 0;
+}
+
+// solves initial_state on n_threads threads, the calling thread being one of them, with the bitmask
+// engine's propagating search (or counting search) and the mrv, propagation, counting and budget options
+// returns what solve_with_options does, the requeue option does not apply
+u64 solve_split(const struct sudoku_solve_options *options, const struct sudoku_grid *initial_state, struct sudoku_grid *into,
+                u32 n_threads, struct sudoku_solve_stats *stats) {
+    assert(n_threads >= 1);
+    assert(!options->iterative);
+    
+#if defined(SUDOKU_STATS)
+    active_stats = stats;
+    stats->depth = 0;
+#endif
+    
+    struct bitmask_state root;
+    if (!initialize_bitmask_state(&root, initial_state)) {
+        *into = *initial_state;
+        return 0;
+    }
+    
+    bitmask_reveal_all(&root, options->techniques);
+    
+    // the partial state when there is no solution or the budget runs out
+    bitmask_state_to_grid(&root, into);
+    
+    if (!bitmask_propagate(&root, options->propagation, options->techniques))
+        return 0;
+    
+    u32 cell_idx;
+    if (!bitmask_pick_branch_cell(&root, options->mrv, &cell_idx)) {
+        bitmask_state_to_grid(&root, into);
+        return 1;
+    }
+    
+    struct bitmask_state *subproblems = malloc(SPLIT_MAX_SUBPROBLEMS * sizeof(subproblems[0]));
+    struct split_worker *workers = calloc(n_threads, sizeof(workers[0]));
+    if (!subproblems || !workers) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    // the open subproblems are [head, tail), expanding one replaces it with its children at the back,
+    // which keeps them in the order the sequential search would visit them
+    u32 head = 0;
+    u32 tail = 0;
+    subproblems[tail++] = root;
+    
+    // solutions found while expanding
+    u64 n_found = 0;
+    u64 cap = options->count_solutions ? options->solution_cap : 1;
+    
+    u32 n_wanted = n_threads * SPLIT_SUBPROBLEMS_PER_THREAD;
+    if (n_wanted > SPLIT_MAX_SUBPROBLEMS / 2)
+        n_wanted = SPLIT_MAX_SUBPROBLEMS / 2;
+    
+    while (head < tail && tail - head < n_wanted && tail + 9 <= SPLIT_MAX_SUBPROBLEMS && (cap == 0 || n_found < cap)) {
+        const struct bitmask_state *parent = &subproblems[head++];
+        
+        // every queued subproblem has an empty cell, the filled out ones were counted instead
+        bitmask_pick_branch_cell(parent, options->mrv, &cell_idx);
+        u32 candidates = bitmask_cell_candidates(parent, cell_idx);
+        
+        while (candidates && (cap == 0 || n_found < cap)) {
+            u32 value = ctz32(candidates) + 1;
+            candidates &= candidates - 1;
+            
+            struct bitmask_state child = *parent;
+            bitmask_set_value(&child, cell_idx, value);
+            stats->nodes++;
+            
+            if (!bitmask_propagate(&child, options->propagation, options->techniques))
+                continue;
+            
+            u32 unused_cell_idx;
+            if (bitmask_pick_branch_cell(&child, options->mrv, &unused_cell_idx)) {
+                subproblems[tail++] = child;
+                continue;
+            }
+            
+            if (n_found == 0)
+                bitmask_state_to_grid(&child, into);
+            n_found++;
+        }
+    }
+    
+    struct split_search search;
+    search.options = options;
+    search.subproblems = subproblems;
+    search.workers = workers;
+    search.n_workers = n_threads;
+    atomic_init(&search.done, false);
+    atomic_init(&search.n_solutions, n_found);
+    
+    u32 n_subproblems = (cap != 0 && n_found >= cap) ? 0 : tail - head;
+    
+    for (u32 i = 0; i < n_threads; i++) {
+        struct split_worker *worker = &workers[i];
+        
+        u32 begin = head + (u32) ((u64) n_subproblems * i / n_threads);
+        u32 end = head + (u32) ((u64) n_subproblems * (i + 1) / n_threads);
+        atomic_init(&worker->range, pack_range(begin, end));
+        
+        worker->worker_idx = i;
+        worker->search = &search;
+    }
+    
+    if (n_subproblems > 0) {
+        // the range of a worker whose thread cannot be created is simply stolen by the others
+        for (u32 i = 1; i < n_threads; i++)
+            workers[i].started = thrd_create(&workers[i].thread, split_worker_main, &workers[i]) == thrd_success;
+        
+        split_worker_main(&workers[0]);
+        
+        for (u32 i = 1; i < n_threads; i++) {
+            if (workers[i].started)
+                thrd_join(workers[i].thread, NULL);
+        }
+    }
+    
+#if defined(SUDOKU_STATS)
+    active_stats = stats;
+#endif
+    
+    bool timed_out = false;
+    for (u32 i = 0; i < n_threads; i++) {
+        add_solve_stats(stats, &workers[i].stats);
+        timed_out |= workers[i].timed_out;
+    }
+    
+    u64 n_solutions;
+    if (options->count_solutions) {
+        n_solutions = atomic_load(&search.n_solutions);
+        if (cap != 0 && n_solutions > cap)
+            n_solutions = cap;
+        
+        // the workers' slices are in search order, so the lowest one with a solution has the first
+        for (u32 i = 0; i < n_threads && n_found == 0; i++) {
+            if (workers[i].has_solution) {
+                *into = workers[i].first_solution;
+                break;
+            }
+        }
+        
+        if (timed_out && (cap == 0 || n_solutions < cap))
+            n_solutions = SUDOKU_TIMED_OUT;
+    } else if (n_found > 0) {
+        n_solutions = 1;
+    } else if (atomic_load(&search.done)) {
+        *into = search.solution;
+        n_solutions = 1;
+    } else {
+        n_solutions = timed_out ? SUDOKU_TIMED_OUT : 0;
+    }
+    
+    if (n_solutions == SUDOKU_TIMED_OUT)
+        stats->timeouts++;
+    
+    free(workers);
+    free(subproblems);
+    
+    return n_solutions;
+}
+
+// ---------------------------------------------------------------------------
+// larger grids
+//
+// grid_n.h is instantiated for box orders 3, 4 and 5 (9x9, 16x16 and 25x25), giving
+// solve_grid_9, solve_grid_16 and solve_grid_25 and the types and helpers that go with them
+// 9x9 puzzles normally go to the engines above, solve_grid_9 is there to compare against
+// their files are read like .sdm files, one puzzle of 81, 256 or 625 characters per line
+// ---------------------------------------------------------------------------
+
+#define GRID_BOX 3
+#include "grid_n.h"
+
+#define GRID_BOX 4
+#include "grid_n.h"
+
+#define GRID_BOX 5
+#include "grid_n.h"
+
+// ---------------------------------------------------------------------------
+// server mode
+//
+// a long running process that answers one .sdm line with one line: the 81 digits of the solution
+// (followed by the number of solutions when counting), "no solution", "timed out" when the puzzle ran out
+// of budget, or an error for a malformed line
+// input is read with plain read() calls into a fixed buffer, every complete line a read brings in is
+// answered before the next read and all of the answers go out in a single write, so a client that
+// sends one puzzle and waits pays for one read and one write, and a client that pipelines many
+// puzzles gets them solved together, on -j threads once there are enough of them
+// a unix socket serves every connection on its own thread with its own buffers and workspaces
+// ---------------------------------------------------------------------------
+
+#define SERVE_BUFFER_SIZE 65536
+
+// answers are flushed before a chunk gets more lines than this
+#define SERVE_MAX_LINES 1024
+
+// the longest answer line, a solution followed by a solution count
+#define SERVE_LINE_SIZE 128
+
+// fewer puzzles than this are solved on the connection's own thread, starting threads would take longer
+#define SERVE_PARALLEL_MIN 64
+
+struct serve_line {
+    // index into grids of a well formed line, -1 otherwise
+    s32 grid_idx;
+    
+    // for a malformed line, the number of characters it had (UINT32_MAX if it did not fit the
+    // buffer), or the position of the bad one
+    u32 n_chars;
+    u32 bad_idx;
+    char bad_char;
+};
+
+struct serve_conn {
+    int in_fd;
+    int out_fd;
+    
+    const struct sudoku_solve_options *options;
+    u32 n_threads;
+    struct sudoku_workspace *workspaces;
+    
+    // shared by every connection, NULL without -C
+    struct solution_cache *cache;
+    
+    // a line longer than the buffer is skipped up to its newline and answered with an error
+    bool discarding;
+    
+    u32 n_lines;
+    u32 n_grids;
+    struct serve_line lines[SERVE_MAX_LINES];
+    struct sudoku_grid grids[SERVE_MAX_LINES];
+    struct sudoku_grid solutions[SERVE_MAX_LINES];
+    u64 solution_counts[SERVE_MAX_LINES];
+    
+    size_t in_len;
+    char in[SERVE_BUFFER_SIZE];
+    char out[SERVE_MAX_LINES * SERVE_LINE_SIZE];
+};
+
+#if defined(_WIN32)
+#define serve_read(fd, buf, n) _read((fd), (buf), (unsigned) (n))
+#define serve_write(fd, buf, n) _write((fd), (buf), (unsigned) (n))
+#else
+#define serve_read(fd, buf, n) read((fd), (buf), (n))
+#define serve_write(fd, buf, n) write((fd), (buf), (n))
+#endif
+
+// writes all of buf, returns false if the other side went away
+bool serve_write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ptrdiff_t n_written = serve_write(fd, buf, len);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return false;
+        
+        buf += n_written;
+        len -= (size_t) n_written;
+    }
+    
+    return true;
+}
+
+// solves the grids of the lines collected so far and writes one answer per line
+bool serve_flush(struct serve_conn *conn) {
+    if (conn->n_lines == 0)
+        return true;
+    
+    if (conn->n_grids > 0) {
+        u32 n_threads = conn->n_grids >= SERVE_PARALLEL_MIN ? conn->n_threads : 1;
+        struct sudoku_solve_stats stats = {0};
+        solve_batch(conn->options, conn->grids, conn->n_grids, conn->solutions, NULL, conn->solution_counts, NULL, conn->cache,
+                    conn->workspaces, n_threads, &stats);
+    }
+    
+    char *out = conn->out;
+    for (u32 line_idx = 0; line_idx < conn->n_lines; line_idx++) {
+        const struct serve_line *line = &conn->lines[line_idx];
+        
+        if (line->grid_idx < 0) {
+            if (line->n_chars == UINT32_MAX)
+                out += snprintf(out, SERVE_LINE_SIZE, "error: the line is longer than %d characters\n", SERVE_BUFFER_SIZE);
+            else if (line->n_chars != 81)
+                out += snprintf(out, SERVE_LINE_SIZE, "error: expected 81 cells but the line has %"PRIu32"\n", line->n_chars);
+            else
+                out += snprintf(out, SERVE_LINE_SIZE, "error: col %"PRIu32": expected number but found '%c'\n", line->bad_idx + 1, line->bad_char);
+            continue;
+        }
+        
+        u64 n_solutions = conn->solution_counts[line->grid_idx];
+        if (n_solutions == 0) {
+            out += snprintf(out, SERVE_LINE_SIZE, "no solution\n");
+            continue;
+        }
+        
+        if (n_solutions == SUDOKU_TIMED_OUT) {
+            out += snprintf(out, SERVE_LINE_SIZE, "timed out\n");
+            continue;
+        }
+        
+        const struct sudoku_grid *solution = &conn->solutions[line->grid_idx];
+        for (u32 cell_idx = 0; cell_idx < 81; cell_idx++)
+            *out++ = (char) ('0' + solution->values[cell_idx / 9][cell_idx % 9]);
+        
+        if (conn->options->count_solutions)
+            out += snprintf(out, SERVE_LINE_SIZE - 81, " %"PRIu64, n_solutions);
+        *out++ = '\n';
+    }
+    
+    conn->n_lines = 0;
+    conn->n_grids = 0;
+    
+    return serve_write_all(conn->out_fd, conn->out, (size_t) (out - conn->out));
+}
+
+// returns the slot for the next answer, answering the queued lines first if there is no room,
+// or NULL if the other side went away
+struct serve_line *serve_queue_line(struct serve_conn *conn) {
+    if (conn->n_lines == SERVE_MAX_LINES && !serve_flush(conn))
+        return NULL;
+    
+    struct serve_line *queued = &conn->lines[conn->n_lines++];
+    queued->grid_idx = -1;
+    queued->n_chars = UINT32_MAX;
+    return queued;
+}
+
+// queues the line [line, line + len) without its newline, a blank line gets an error like any
+// other line that is not 81 cells, so every line of the request has its answer
+bool serve_add_line(struct serve_conn *conn, const char *line, size_t len) {
+    // trailing whitespace, \r in particular, is not part of the puzzle
+    while (len > 0 && isspace((unsigned char) line[len - 1]))
+        len--;
+    
+    struct serve_line *queued = serve_queue_line(conn);
+    if (!queued)
+        return false;
+    
+    // the buffer is smaller than UINT32_MAX
+    queued->n_chars = (u32) len;
+    
+    if (len == 81) {
+        queued->bad_idx = parse_sdm_cells(line, &conn->grids[conn->n_grids]);
+        if (queued->bad_idx < 81)
+            queued->bad_char = line[queued->bad_idx];
+        else
+            queued->grid_idx = (s32) conn->n_grids++;
+    }
+    
+    return true;
+}
+
+// answers the lines of in_fd on out_fd until in_fd ends or out_fd is closed
+void serve_stream(struct serve_conn *conn) {
+    conn->in_len = 0;
+    conn->discarding = false;
+    conn->n_lines = 0;
+    conn->n_grids = 0;
+    
+    for (;;) {
+        ptrdiff_t n_read = serve_read(conn->in_fd, conn->in + conn->in_len, SERVE_BUFFER_SIZE - conn->in_len);
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        
+        if (n_read <= 0) {
+            // the last line does not need a newline, but input that ends with one has no last line
+            if (conn->discarding ? serve_queue_line(conn) != NULL
+                                 : conn->in_len == 0 || serve_add_line(conn, conn->in, conn->in_len))
+                serve_flush(conn);
+            return;
+        }
+        
+        size_t new_len = conn->in_len + (size_t) n_read;
+        size_t line_start = 0;
+        for (size_t pos = conn->in_len; pos < new_len; pos++) {
+            if (conn->in[pos] != '\n')
+                continue;
+            
+            if (conn->discarding) {
+                conn->discarding = false;
+                if (!serve_queue_line(conn))
+                    return;
+            } else if (!serve_add_line(conn, &conn->in[line_start], pos - line_start)) {
+                return;
+            }
+            
+            line_start = pos + 1;
+        }
+        
+        if (!serve_flush(conn))
+            return;
+        
+        // keep the partial line, a buffer full of one line means the line is too long for a puzzle
+        conn->in_len = new_len - line_start;
+        memmove(conn->in, &conn->in[line_start], conn->in_len);
+        if (conn->in_len == SERVE_BUFFER_SIZE) {
+            conn->discarding = true;
+            conn->in_len = 0;
+        }
+    }
+}
+
+struct serve_conn *serve_conn_create(const struct sudoku_solve_options *options, u32 n_threads, struct solution_cache *cache,
+                                     int in_fd, int out_fd) {
+    struct serve_conn *conn = malloc(sizeof(*conn));
+    struct sudoku_workspace *workspaces = malloc(n_threads * sizeof(workspaces[0]));
+    if (!conn || !workspaces) {
+        free(conn);
+        free(workspaces);
+        return NULL;
+    }
+    
+    conn->in_fd = in_fd;
+    conn->out_fd = out_fd;
+    conn->options = options;
+    conn->n_threads = n_threads;
+    conn->workspaces = workspaces;
+    conn->cache = cache;
+    return conn;
+}
+
+void serve_conn_destroy(struct serve_conn *conn) {
+    free(conn->workspaces);
+    free(conn);
+}
+
+// answers stdin on stdout until stdin ends
+void serve_stdin(const struct sudoku_solve_options *options, u32 n_threads, struct solution_cache *cache) {
+    struct serve_conn *conn = serve_conn_create(options, n_threads, cache, 0, 1);
+    if (!conn) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+#if defined(_WIN32)
+    _setmode(0, _O_BINARY);
+    _setmode(1, _O_BINARY);
+#endif
+    
+    serve_stream(conn);
+    serve_conn_destroy(conn);
+}
+
+#if !defined(_WIN32)
+
+int serve_conn_main(void *arg) {
+    struct serve_conn *conn = arg;
+    serve_stream(conn);
+    close(conn->in_fd);
+    serve_conn_destroy(conn);
+    return 0;
+}
+
+// listens on a unix socket at path, replacing whatever socket was there, and serves every
+// connection on its own thread until the process is killed
+void serve_socket(const struct sudoku_solve_options *options, u32 n_threads, struct solution_cache *cache, const char *path) {
+    // a client that disconnects before reading its answers must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path '%s' is too long\n", path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+        perror("bind");
+        exit(1);
+    }
+    
+    for (;;) {
+        int conn_fd = accept(listen_fd, NULL, NULL);
+        if (conn_fd < 0) {
+            // a client that gave up while queued costs nothing, running out of descriptors or memory
+            // passes once connections close, so wait for that instead of spinning on accept, and
+            // anything else means the socket itself is broken
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            
+            int error = errno;
+            perror("accept");
+            if (error != EMFILE && error != ENFILE && error != ENOBUFS && error != ENOMEM)
+                exit(1);
+            
+            thrd_sleep(&(struct timespec) {.tv_nsec = 100000000}, NULL);
+            continue;
+        }
+        
+        struct serve_conn *conn = serve_conn_create(options, n_threads, cache, conn_fd, conn_fd);
+        thrd_t thread;
+        if (!conn || thrd_create(&thread, serve_conn_main, conn) != thrd_success) {
+            fprintf(stderr, "cannot serve another connection\n");
+            if (conn)
+                serve_conn_destroy(conn);
+            close(conn_fd);
+            continue;
+        }
+        
+        thrd_detach(thread);
+    }
+}
+
+#endif
+
+#if defined(SUDOKU_STATS)
+
+// writes the stats of every puzzle as csv, or as a json array if the file name ends in .json
+struct stats_writer {
+    FILE *fp;
+    bool json;
+    u64 n_written;
+};
+
+void stats_writer_open(struct stats_writer *writer, const char *file_name) {
+    writer->fp = fopen(file_name, "w");
+    if (writer->fp == NULL) {
+        perror("fopen: ");
+        exit(1);
+    }
+    
+    size_t file_name_len = strlen(file_name);
+    writer->json = file_name_len >= 5 && strcmp(&file_name[file_name_len-5], ".json") == 0;
+    writer->n_written = 0;
+    
+    if (writer->json) {
+        fprintf(writer->fp, "[\n");
+    } else {
+        fprintf(writer->fp, "puzzle,nodes,backtracks,backjumps,nogoods_learned,nogood_hits,restarts,max_depth,lone_singles,hidden_singles,naked_pair_eliminations,naked_subset_eliminations,hidden_subset_eliminations,"
+                "set_value_calls,unset_value_calls,setup_us,logic_us,search_us");
+        for (u32 i = 0; i < SUDOKU_N_TECHNIQUES; i++)
+            fprintf(writer->fp, ",%s_hits,%s_eliminations,%s_us", technique_names[i], technique_names[i], technique_names[i]);
+        fprintf(writer->fp, "\n");
+    }
+}
+
+// puzzle_num counts from 1, like the grid numbers in error messages
+void stats_writer_write(struct stats_writer *writer, u64 puzzle_num, const struct sudoku_solve_stats *stats) {
+    if (writer->json) {
+        fprintf(writer->fp, "%s  {\"puzzle\": %"PRIu64", \"nodes\": %"PRIu64", \"backtracks\": %"PRIu64", "
+                "\"backjumps\": %"PRIu64", \"nogoods_learned\": %"PRIu64", \"nogood_hits\": %"PRIu64", \"restarts\": %"PRIu64", "
+                "\"max_depth\": %"PRIu32", "
+                "\"lone_singles\": %"PRIu64", \"hidden_singles\": %"PRIu64", \"naked_pair_eliminations\": %"PRIu64", "
+                "\"naked_subset_eliminations\": %"PRIu64", \"hidden_subset_eliminations\": %"PRIu64", "
+                "\"set_value_calls\": %"PRIu64", \"unset_value_calls\": %"PRIu64", "
+                "\"setup_us\": %.3f, \"logic_us\": %.3f, \"search_us\": %.3f",
+                writer->n_written > 0 ? ",\n" : "", puzzle_num, stats->nodes, stats->backtracks,
+                stats->backjumps, stats->nogoods_learned, stats->nogood_hits, stats->restarts, stats->max_depth,
+                stats->lone_singles, stats->hidden_singles, stats->naked_pair_eliminations,
+                stats->naked_subset_eliminations, stats->hidden_subset_eliminations,
+                stats->set_value_calls, stats->unset_value_calls,
+                stats->setup_seconds * 1e6, stats->logic_seconds * 1e6, stats->search_seconds * 1e6);
+        for (u32 i = 0; i < SUDOKU_N_TECHNIQUES; i++)
+            fprintf(writer->fp, ", \"%s_hits\": %"PRIu64", \"%s_eliminations\": %"PRIu64", \"%s_us\": %.3f",
+                    technique_names[i], stats->technique_hits[i], technique_names[i], stats->technique_eliminations[i],
+                    technique_names[i], stats->technique_seconds[i] * 1e6);
+        fprintf(writer->fp, "}");
+    } else {
+        fprintf(writer->fp, "%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu32",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%.3f,%.3f,%.3f",
+                puzzle_num, stats->nodes, stats->backtracks, stats->backjumps, stats->nogoods_learned, stats->nogood_hits,
+                stats->restarts, stats->max_depth,
+                stats->lone_singles, stats->hidden_singles, stats->naked_pair_eliminations,
+                stats->naked_subset_eliminations, stats->hidden_subset_eliminations,
+                stats->set_value_calls, stats->unset_value_calls,
+                stats->setup_seconds * 1e6, stats->logic_seconds * 1e6, stats->search_seconds * 1e6);
+        for (u32 i = 0; i < SUDOKU_N_TECHNIQUES; i++)
+            fprintf(writer->fp, ",%"PRIu64",%"PRIu64",%.3f", stats->technique_hits[i], stats->technique_eliminations[i],
+                    stats->technique_seconds[i] * 1e6);
+        fprintf(writer->fp, "\n");
+    }
+    
+    writer->n_written++;
+}
+
+void stats_writer_close(struct stats_writer *writer) {
+    if (writer->json)
+        fprintf(writer->fp, "\n]\n");
+    fclose(writer->fp);
+}
+
+// totals over every puzzle of the file
+void print_stats_summary(const struct sudoku_solve_stats *stats, u64 n_puzzles) {
+    printf("puzzles:                 %"PRIu64"\n", n_puzzles);
+    printf("search nodes:            %"PRIu64"\n", stats->nodes);
+    printf("backtracks:              %"PRIu64"\n", stats->backtracks);
+    printf("backjumps:               %"PRIu64"\n", stats->backjumps);
+    printf("nogoods learned:         %"PRIu64"\n", stats->nogoods_learned);
+    printf("nogood hits:             %"PRIu64"\n", stats->nogood_hits);
+    printf("max depth:               %"PRIu32"\n", stats->max_depth);
+    printf("lone singles:            %"PRIu64"\n", stats->lone_singles);
+    printf("hidden singles:          %"PRIu64"\n", stats->hidden_singles);
+    printf("naked pair eliminations: %"PRIu64"\n", stats->naked_pair_eliminations);
+    printf("naked subset elims:      %"PRIu64"\n", stats->naked_subset_eliminations);
+    printf("hidden subset elims:     %"PRIu64"\n", stats->hidden_subset_eliminations);
+    printf("set_value calls:         %"PRIu64"\n", stats->set_value_calls);
+    printf("unset_value calls:       %"PRIu64"\n", stats->unset_value_calls);
+    printf("setup time:              %f seconds\n", stats->setup_seconds);
+    printf("logic time:              %f seconds\n", stats->logic_seconds);
+    printf("search time:             %f seconds\n", stats->search_seconds);
+    for (u32 i = 0; i < SUDOKU_N_TECHNIQUES; i++) {
+        if (stats->technique_hits[i] == 0 && stats->technique_seconds[i] == 0)
+            continue;
+        char label[32];
+        snprintf(label, sizeof(label), "%s:", technique_names[i]);
+        printf("%-25s%"PRIu64" hits, %"PRIu64" eliminations, %f seconds\n", label,
+               stats->technique_hits[i], stats->technique_eliminations[i], stats->technique_seconds[i]);
+    }
+}
+
+#endif
+
+// number of puzzles read from a .sdm file and solved at a time
+#define SDM_BATCH_SIZE 4096
+
+// ---------------------------------------------------------------------------
+// benchmark mode
+//
+// every puzzle of every file is solved warmup times untimed, then reps times with each solve
+// timed on its own, which gives the latency distribution per file instead of one total
+// results can be written as a csv baseline and a later run compared against it
+// ---------------------------------------------------------------------------
+
+struct bench_result {
+    char file_name[256];
+    double puzzles_per_sec;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+};
+
+// reads every puzzle of a .ss, .sdm or .sdb file into a growing array, returns the number of puzzles
+u32 load_bench_puzzles(const char *file_name, struct sudoku_grid **into) {
+    if (has_extension(file_name, ".sdm") || has_extension(file_name, ".sdb")) {
+        struct sdm_reader *reader = malloc(sizeof(*reader));
+        u32 capacity = 1024;
+        struct sudoku_grid *grids = malloc(capacity * sizeof(grids[0]));
+        if (!reader || !grids) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        
+        sdm_reader_open(reader, file_name);
+        
+        u32 n_grids = 0;
+        for (;;) {
+            if (n_grids == capacity) {
+                capacity *= 2;
+                grids = realloc(grids, capacity * sizeof(grids[0]));
+                if (!grids) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            
+            if (!sdm_reader_next(reader, &grids[n_grids]))
+                break;
+            n_grids++;
+        }
+        
+        sdm_reader_close(reader);
+        free(reader);
+        
+        *into = grids;
+        return n_grids;
+    }
+    
+    struct sudoku_grid *grid = malloc(sizeof(*grid));
+    if (!grid) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    load_grid_from_file(file_name, grid);
+    
+    *into = grid;
+    return 1;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted
+double percentile(const double *sorted, u64 n, double p) {
+    u64 rank = (u64) (p / 100.0 * n + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return sorted[rank - 1];
+}
+
+// files with few puzzles get more timed passes so their percentiles are not made of a handful of samples
+#define BENCH_MIN_SAMPLES 1000
+
+// times the n_puzzles puzzles read from file_name
+void bench_file(const struct sudoku_solve_options *options, const char *file_name, const struct sudoku_grid *puzzles, u32 n_puzzles,
+                u32 warmup, u32 reps, struct bench_result *into) {
+    if (n_puzzles > 0 && (u64) n_puzzles * reps < BENCH_MIN_SAMPLES)
+        reps = (BENCH_MIN_SAMPLES + n_puzzles - 1) / n_puzzles;
+    
+    u64 n_samples = (u64) n_puzzles * reps;
+    double *latencies = malloc((n_samples ? n_samples : 1) * sizeof(latencies[0]));
+    if (!latencies) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    struct solve_workspace *workspace = malloc(sizeof(*workspace));
+    if (!workspace) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
     
-    u32 row_idx = 0;
-    // .ss consists of 11 lines
-    for (u32 line_num = 0; line_num < 11; line_num++) {
-        if (line_num == 3 || line_num == 7) {
-            next_char += 11;
+    struct sudoku_solve_stats stats = {0};
+    struct sudoku_grid solution;
+    
+    for (u32 i = 0; i < warmup; i++)
+        for (u32 puzzle_idx = 0; puzzle_idx < n_puzzles; puzzle_idx++)
+            solve_with_options(options, &puzzles[puzzle_idx], &solution, workspace, &stats);
+    
+    double total = 0;
+    u64 sample_idx = 0;
+    for (u32 rep = 0; rep < reps; rep++) {
+        for (u32 puzzle_idx = 0; puzzle_idx < n_puzzles; puzzle_idx++) {
+            double start = monotonic_seconds();
+            u64 n_solutions = solve_with_options(options, &puzzles[puzzle_idx], &solution, workspace, &stats);
+            double end = monotonic_seconds();
             
-        } else {
-            u32 col_idx = 0;
-            for(u32 i=0;i<11;i++) {
-                char c = *next_char++;
-                if (c == '|') {
-                    continue;
-                }
-                if (c == '.') {
-                    into->values[row_idx][col_idx] = 0;
-                } else if (c >= '0' && c <= '9') {
-                    into->values[row_idx][col_idx] = c - '0';
-                } else {
-						fprintf(stderr, "error parsing .ss file: line %d char %d, expected digit but found %c\n", line_num+1, col_idx+1, c);
-				}
-                
-                col_idx++;
+            if (n_solutions == 0) {
+                printf("%s grid %"PRIu32": has no solution\n", file_name, puzzle_idx + 1);
+                exit(1);
             }
-			row_idx++;
+            
+            if (n_solutions == SUDOKU_TIMED_OUT) {
+                printf("%s grid %"PRIu32": ran out of budget\n", file_name, puzzle_idx + 1);
+                exit(1);
+            }
+            
+            // verifying is not part of the timing
+            struct is_solved_result solved_result = is_solved(&solution);
+            if (!solved_result.is_solved) {
+                char error_str[ERROR_STR_SIZE];
+                printf("%s grid %"PRIu32": "INCORRECT_SOLUTION_BANNER"\n%s\n", file_name, puzzle_idx + 1, make_error_str(solved_result, error_str));
+                exit(1);
+            }
+            
+            latencies[sample_idx++] = end - start;
+            total += end - start;
         }
-
-		// skip all whitespace
-		while (isspace(*next_char))
-			next_char++;
     }
+    
+    qsort(latencies, n_samples, sizeof(latencies[0]), compare_doubles);
+    
+    snprintf(into->file_name, sizeof(into->file_name), "%s", file_name);
+    into->puzzles_per_sec = total > 0 ? n_samples / total : 0;
+    into->p50_us = n_samples ? percentile(latencies, n_samples, 50) * 1e6 : 0;
+    into->p90_us = n_samples ? percentile(latencies, n_samples, 90) * 1e6 : 0;
+    into->p99_us = n_samples ? percentile(latencies, n_samples, 99) * 1e6 : 0;
+    into->max_us = n_samples ? latencies[n_samples - 1] * 1e6 : 0;
+    
+    free(workspace);
+    free(latencies);
 }
 
-// populates into with the contents from sudoku file filename
-void load_grid_from_file(const char *file_name, struct grid *into) {
+// reads a baseline written by a previous benchmark run into a growing array, returns the number of files in it
+u32 load_bench_baseline(const char *file_name, struct bench_result **into) {
     FILE *fp = fopen(file_name, "r");
     if (fp == NULL) {
         perror("fopen: ");
         exit(1);
     }
     
+    char line[1024];
+    u32 n_results = 0;
+    u32 capacity = 64;
+    struct bench_result *results = malloc(capacity * sizeof(results[0]));
+    if (!results) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    while (fgets(line, sizeof(line), fp)) {
+        if (n_results == capacity) {
+            capacity *= 2;
+            results = realloc(results, capacity * sizeof(results[0]));
+            if (!results) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+        
+        struct bench_result *result = &results[n_results];
+        
+        // the header does not parse and is skipped like any malformed line
+        if (sscanf(line, "%255[^,],%lf,%lf,%lf,%lf,%lf", result->file_name, &result->puzzles_per_sec,
+                   &result->p50_us, &result->p90_us, &result->p99_us, &result->max_us) == 6)
+            n_results++;
+    }
     
-    char file_contents[4096];
-    size_t n_read = fread(file_contents, 1, 4096, fp);
     fclose(fp);
-	file_contents[n_read] = 0;
     
-    size_t file_name_len = strlen(file_name);
+    *into = results;
+    return n_results;
+}
+
+// how much worse current is than baseline in percent, positive means slower
+double percent_slower(double baseline, double current, bool higher_is_better) {
+    if (baseline <= 0 || current <= 0)
+        return 0;
+    if (higher_is_better)
+        return (baseline / current - 1) * 100;
+    return (current / baseline - 1) * 100;
+}
+
+// benchmarks every file, writes the results to baseline_out and compares them with
+// baseline_in if those are not NULL
+// returns 2 if puzzles/sec or the p50 latency of some file got worse than the baseline by more
+// than tolerance percent, 0 otherwise
+int run_benchmark(const struct sudoku_solve_options *options, char **file_names, u32 n_files, u32 warmup, u32 reps,
+                  const char *baseline_out, const char *baseline_in, double tolerance) {
+    struct bench_result *results = malloc(n_files * sizeof(results[0]));
+    struct sudoku_grid **puzzles = malloc(n_files * sizeof(puzzles[0]));
+    u32 *n_puzzles = malloc(n_files * sizeof(n_puzzles[0]));
+    if (!results || !puzzles || !n_puzzles) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
     
-    if (strcmp(&file_name[file_name_len-3], ".ss") == 0) {
+    // every file is read before any is timed, so one that does not parse stops the run (naming the
+    // file) before it has spent any time, rather than after the files before it were timed
+    for (u32 file_idx = 0; file_idx < n_files; file_idx++) {
+        puzzles[file_idx] = NULL;
+        n_puzzles[file_idx] = 0;
+        if (large_grid_side(file_names[file_idx]) == 0)
+            n_puzzles[file_idx] = load_bench_puzzles(file_names[file_idx], &puzzles[file_idx]);
+    }
+    
+    struct bench_result *baseline = NULL;
+    u32 n_baseline = 0;
+    if (baseline_in)
+        n_baseline = load_bench_baseline(baseline_in, &baseline);
+    
+    printf("%-32s %14s %10s %10s %10s %10s\n", "file", "puzzles/sec", "p50 us", "p90 us", "p99 us", "max us");
+    
+    int exit_code = 0;
+    u32 n_results = 0;
+    
+    for (u32 file_idx = 0; file_idx < n_files; file_idx++) {
+        // so that -b data/* can run over a directory that also has the larger grids
+        u32 side = large_grid_side(file_names[file_idx]);
+        if (side != 0) {
+            fprintf(stderr, "skipping %s, its %"PRIu32"x%"PRIu32" puzzles need -g, which -b does not support\n", file_names[file_idx], side, side);
+            continue;
+        }
         
-        printf("reading .ss format\n");
+        struct bench_result *result = &results[n_results++];
+        bench_file(options, file_names[file_idx], puzzles[file_idx], n_puzzles[file_idx], warmup, reps, result);
         
-        parse_ss_format(file_contents, into);
+        printf("%-32s %14.1f %10.2f %10.2f %10.2f %10.2f\n", result->file_name, result->puzzles_per_sec,
+               result->p50_us, result->p90_us, result->p99_us, result->max_us);
         
+        for (u32 i = 0; i < n_baseline; i++) {
+            if (strcmp(baseline[i].file_name, result->file_name) != 0)
+                continue;
+            
+            double throughput_change = percent_slower(baseline[i].puzzles_per_sec, result->puzzles_per_sec, true);
+            double p50_change = percent_slower(baseline[i].p50_us, result->p50_us, false);
+            double p99_change = percent_slower(baseline[i].p99_us, result->p99_us, false);
+            
+            bool regressed = throughput_change > tolerance || p50_change > tolerance;
+            if (regressed)
+                exit_code = 2;
+            
+            printf("%-32s %+13.1f%% %+9.1f%% %10s %+9.1f%% %10s %s\n", "  vs baseline (+ is slower)", throughput_change,
+                   p50_change, "", p99_change, "", regressed ? "REGRESSION" : "ok");
+        }
+    }
+    
+    if (baseline_out) {
+        FILE *fp = fopen(baseline_out, "w");
+        if (fp == NULL) {
+            perror("fopen: ");
+            exit(1);
+        }
         
-    } else {
-        printf("file format not supported\n");
-        exit(1);
+        fprintf(fp, "file,puzzles_per_sec,p50_us,p90_us,p99_us,max_us\n");
+        for (u32 i = 0; i < n_results; i++)
+            fprintf(fp, "%s,%f,%f,%f,%f,%f\n", results[i].file_name, results[i].puzzles_per_sec,
+                    results[i].p50_us, results[i].p90_us, results[i].p99_us, results[i].max_us);
+        fclose(fp);
     }
+    
+    for (u32 file_idx = 0; file_idx < n_files; file_idx++)
+        free(puzzles[file_idx]);
+    free(puzzles);
+    free(n_puzzles);
+    free(results);
+    free(baseline);
+    
+    return exit_code;
 }
 
+void print_usage(void) {
+	fprintf(stderr, "usage: sudoku [-e collisions|bitmask|dlx] [-m] [-i] [-B] [-V lcv|random] [-z seed] [-Z luby|geometric[,nodes]] [-p singles|pairs] [-X techniques] [-n cap|-u] [-k scalar|sse2|avx2] [-l] [-T] [-g 9|16|25] [-j threads] [-s stats.csv|stats.json] [-L nodes] [-D ms] [-R engine] [-C entries] [-P cache file] [-F first] [-N count] <file.ss|file.sdm|file.sdb|file.sd16|file.sd25|->\n");
+	fprintf(stderr, "  -e  solving engine to use, collisions by default\n");
+	fprintf(stderr, "  -m  branch on the most constrained cell, ties broken at random with the collisions engine (not with dlx)\n");
+	fprintf(stderr, "  -i  non-recursive search with an explicit guess stack (bitmask engine only)\n");
+	fprintf(stderr, "  -B  jump back to the guess that caused a dead end and remember small sets of guesses that fail\n");
+	fprintf(stderr, "      (collisions engine only)\n");
+	fprintf(stderr, "  -V  try the values of a cell least constraining first, or in a random order (collisions engine only)\n");
+	fprintf(stderr, "  -z  seed of the random order and of the -m ties, 0 by default\n");
+	fprintf(stderr, "  -Z  start the search over after nodes (100 by default) times the luby sequence, or 1.5 times more nodes\n");
+	fprintf(stderr, "      every time (collisions engine only, with -m, -V random or -B so that the next search differs)\n");
+	fprintf(stderr, "  -p  propagate singles (or singles and naked pairs) after every guess (bitmask engine only)\n");
+	fprintf(stderr, "  -X  also try these techniques, comma separated, once singles find nothing more (not with the dlx engine):\n");
+	fprintf(stderr, "      pointing, box_line, x_wing, swordfish or all, after every guess too with the bitmask engine and -p\n");
+	fprintf(stderr, "  -n  count the solutions of every puzzle, stopping at cap of them (0 for no cap) (bitmask and dlx engines only)\n");
+	fprintf(stderr, "  -u  check that every puzzle has exactly one solution, same as -n 2\n");
+	fprintf(stderr, "  -k  candidate mask kernel of the collisions engine, the best one the cpu supports by default\n");
+	fprintf(stderr, "  -l  propagate singles for 16 puzzles of a .sdm collection at once before solving them (needs avx2)\n");
+	fprintf(stderr, "  -T  finish what lone and hidden singles alone can before the engine, and count how puzzles were routed\n");
+	fprintf(stderr, "  -L  give up on a puzzle after that many search nodes, reporting it as timed out\n");
+	fprintf(stderr, "  -D  give up on a puzzle after that many milliseconds of search\n");
+	fprintf(stderr, "  -R  try a puzzle that ran out of budget once more with that engine, on a budget of its own\n");
+	fprintf(stderr, "  -g  the file (a .sd16 or .sd25 file for 16 and 25) has one puzzle of that side length per line, solved by\n");
+	fprintf(stderr, "      the engine for that size\n");
+	fprintf(stderr, "      (which always propagates singles and branches on the most constrained cell, -e does not apply, on one thread)\n");
+	fprintf(stderr, "  -   reads a .sdm (or .sdb) collection from stdin\n");
+	fprintf(stderr, "  -j  number of threads solving a .sdm collection, 1 by default, or splitting the search of a .ss\n");
+	fprintf(stderr, "      puzzle (bitmask engine only, which then searches like with -p singles)\n");
+	fprintf(stderr, "  -s  write the stats of every puzzle as csv or json (needs a build with -DSUDOKU_STATS)\n");
+	fprintf(stderr, "  -C  look puzzles up by canonical form in a cache of that many solutions before solving them\n");
+	fprintf(stderr, "  -P  load the cache from the file and save it there at the end, %d entries unless -C says otherwise\n", SOLUTION_CACHE_DEFAULT_ENTRIES);
+	fprintf(stderr, "  -F  start at that puzzle of a collection, counting from 1 (a .sdb file jumps there through its index)\n");
+	fprintf(stderr, "  -N  solve at most that many puzzles of a collection\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "       sudoku -x out.sdb|out.sdm|out.ss [-F first] [-N count] <file.ss|file.sdm|file.sdb|->\n");
+	fprintf(stderr, "  -x  write the puzzles of the file in the format the extension of out names\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "       sudoku -S [solver options] [-j threads] <-|socket path>\n");
+	fprintf(stderr, "  -S  keep answering one .sdm line with one solution line, on stdin and stdout or on every\n");
+	fprintf(stderr, "      connection to a unix socket, -j threads solve the lines a client sends at once\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "       sudoku -b [solver options] [-w warmup] [-r reps] [-o baseline.csv] [-c baseline.csv] [-t percent] <files...>\n");
+	fprintf(stderr, "  -b  benchmark every puzzle of the files, one solve at a time\n");
+	fprintf(stderr, "  -w  untimed passes over each file before timing, 1 by default\n");
+	fprintf(stderr, "  -r  timed passes over each file, 5 by default, more for small files so each gets %d timed solves\n", BENCH_MIN_SAMPLES);
+	fprintf(stderr, "  -o  write the results as a baseline\n");
+	fprintf(stderr, "  -c  compare with a baseline, exits with 2 on a regression\n");
+	fprintf(stderr, "  -t  how many percent slower than the baseline counts as a regression, 10 by default\n");
+}
 
-// grid must be large enough to hold as many puzzles as there are in the file
-// returns the number of puzzles read
-u32 load_sdm_collection(const char *file_name, struct grid *into) {
-	FILE *fp = fopen(file_name, "r");
-    if (fp == NULL) {
-        perror("fopen: ");
-        exit(1);
-    }
-    
-    char file_contents[65655];
-    size_t n_read = fread(file_contents, 1, 65655, fp);
-    fclose(fp);
-	file_contents[n_read] = 0;
+int main(int argc, char *argv[]) {
+	struct sudoku_solve_options options = {0};
+	options.engine = SUDOKU_ENGINE_COLLISIONS;
 
-	char *next_char = file_contents;
-	
-	u32 line_num;
-	for (line_num = 0; *next_char; line_num++) {
-		struct grid *into_grid = &into[line_num];
-
-		for (u32 r = 0; r < 9; r++) {
-			for (u32 c = 0; c < 9; c++) {
-				char ch = *next_char;
-
-				if (ch == '.') {
-					into_grid->values[r][c] = 0;
-				} else if (ch >= '0' && ch <= '9') {
-					into_grid->values[r][c] = ch - '0';
+	char *filename = NULL;
+	char *stats_filename = NULL;
+	u32 n_threads = 1;
+	kernel_level kernel = KERNEL_AUTO;
+
+	// 0 unless -g picked the engine for a given grid size
+	u32 grid_side = 0;
+
+	bool serve = false;
+
+	// -x converts the file instead of solving it, -F and -N pick a range of a collection
+	char *convert_filename = NULL;
+	u64 first_puzzle = 1;
+	u64 max_puzzles = 0;
+
+	// the solution cache is off unless -C or -P is given
+	u32 cache_entries = 0;
+	char *cache_filename = NULL;
+
+	bool benchmark = false;
+	u32 bench_warmup = 1;
+	u32 bench_reps = 5;
+	char *baseline_out = NULL;
+	char *baseline_in = NULL;
+	double bench_tolerance = 10;
+
+	// only the benchmark takes more than one file
+	char **file_names = malloc(argc * sizeof(file_names[0]));
+	u32 n_files = 0;
+	if (!file_names) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (int arg_idx = 1; arg_idx < argc; arg_idx++) {
+		char *arg = argv[arg_idx];
+
+		if (strcmp(arg, "-e") == 0 && arg_idx + 1 < argc) {
+			char *engine_name = argv[++arg_idx];
+			if (strcmp(engine_name, "collisions") == 0) {
+				options.engine = SUDOKU_ENGINE_COLLISIONS;
+			} else if (strcmp(engine_name, "bitmask") == 0) {
+				options.engine = SUDOKU_ENGINE_BITMASK;
+			} else if (strcmp(engine_name, "dlx") == 0) {
+				options.engine = SUDOKU_ENGINE_DLX;
+			} else {
+				fprintf(stderr, "unknown engine '%s'\n", engine_name);
+				print_usage();
+				exit(1);
+			}
+		} else if (strcmp(arg, "-m") == 0) {
+			options.mrv = true;
+		} else if (strcmp(arg, "-i") == 0) {
+			options.iterative = true;
+		} else if (strcmp(arg, "-B") == 0) {
+			options.backjump = true;
+		} else if (strcmp(arg, "-V") == 0 && arg_idx + 1 < argc) {
+			char *order_name = argv[++arg_idx];
+			if (strcmp(order_name, "ascending") == 0) {
+				options.value_order = SUDOKU_VALUE_ORDER_ASCENDING;
+			} else if (strcmp(order_name, "lcv") == 0) {
+				options.value_order = SUDOKU_VALUE_ORDER_LCV;
+			} else if (strcmp(order_name, "random") == 0) {
+				options.value_order = SUDOKU_VALUE_ORDER_RANDOM;
+			} else {
+				fprintf(stderr, "unknown value order '%s'\n", order_name);
+				print_usage();
+				exit(1);
+			}
+		} else if (strcmp(arg, "-z") == 0 && arg_idx + 1 < argc) {
+			options.seed = strtoull(argv[++arg_idx], NULL, 10);
+		} else if (strcmp(arg, "-Z") == 0 && arg_idx + 1 < argc) {
+			// luby or geometric, optionally followed by the number of nodes of the first run, e.g. luby,200
+			char *policy_name = strtok(argv[++arg_idx], ",");
+			char *unit = strtok(NULL, ",");
+			if (policy_name && strcmp(policy_name, "luby") == 0) {
+				options.restarts = SUDOKU_RESTART_LUBY;
+			} else if (policy_name && strcmp(policy_name, "geometric") == 0) {
+				options.restarts = SUDOKU_RESTART_GEOMETRIC;
+			} else {
+				fprintf(stderr, "unknown restart policy '%s'\n", policy_name ? policy_name : "");
+				print_usage();
+				exit(1);
+			}
+			if (unit)
+				options.restart_nodes = strtoull(unit, NULL, 10);
+		} else if (strcmp(arg, "-p") == 0 && arg_idx + 1 < argc) {
+			char *level_name = argv[++arg_idx];
+			if (strcmp(level_name, "singles") == 0) {
+				options.propagation = SUDOKU_PROPAGATE_SINGLES;
+			} else if (strcmp(level_name, "pairs") == 0) {
+				options.propagation = SUDOKU_PROPAGATE_PAIRS;
+			} else {
+				fprintf(stderr, "unknown propagation '%s'\n", level_name);
+				print_usage();
+				exit(1);
+			}
+		} else if (strcmp(arg, "-X") == 0 && arg_idx + 1 < argc) {
+			for (char *name = strtok(argv[++arg_idx], ","); name; name = strtok(NULL, ",")) {
+				u32 technique_idx = 0;
+				while (technique_idx < SUDOKU_N_TECHNIQUES && strcmp(name, technique_names[technique_idx]) != 0)
+					technique_idx++;
+
+				if (strcmp(name, "all") == 0) {
+					options.techniques = (1u << SUDOKU_N_TECHNIQUES) - 1;
+				} else if (technique_idx < SUDOKU_N_TECHNIQUES) {
+					options.techniques |= 1u << technique_idx;
 				} else {
-					printf("line %"PRIu32", col %"PRIu32": expected number but found '%c'\n", line_num+1, (r+1)*(c+1), ch);
+					fprintf(stderr, "unknown technique '%s'\n", name);
+					print_usage();
 					exit(1);
 				}
-
-				next_char++;
 			}
+		} else if (strcmp(arg, "-n") == 0 && arg_idx + 1 < argc) {
+			options.count_solutions = true;
+			options.solution_cap = strtoull(argv[++arg_idx], NULL, 10);
+		} else if (strcmp(arg, "-u") == 0) {
+			options.count_solutions = true;
+			options.solution_cap = 2;
+		} else if (strcmp(arg, "-k") == 0 && arg_idx + 1 < argc) {
+			char *kernel_name = argv[++arg_idx];
+			if (strcmp(kernel_name, "scalar") == 0) {
+				kernel = KERNEL_SCALAR;
+			} else if (strcmp(kernel_name, "sse2") == 0) {
+				kernel = KERNEL_SSE2;
+			} else if (strcmp(kernel_name, "avx2") == 0) {
+				kernel = KERNEL_AVX2;
+			} else {
+				fprintf(stderr, "unknown kernel '%s'\n", kernel_name);
+				print_usage();
+				exit(1);
+			}
+		} else if (strcmp(arg, "-g") == 0 && arg_idx + 1 < argc) {
+			grid_side = (u32) atoi(argv[++arg_idx]);
+			if (grid_side != 9 && grid_side != 16 && grid_side != 25) {
+				fprintf(stderr, "-g takes 9, 16 or 25\n");
+				exit(1);
+			}
+		} else if (strcmp(arg, "-l") == 0) {
+			options.lockstep = true;
+		} else if (strcmp(arg, "-T") == 0) {
+			options.tiered = true;
+		} else if (strcmp(arg, "-L") == 0 && arg_idx + 1 < argc) {
+			options.node_budget = strtoull(argv[++arg_idx], NULL, 10);
+		} else if (strcmp(arg, "-D") == 0 && arg_idx + 1 < argc) {
+			options.time_budget_seconds = atof(argv[++arg_idx]) / 1000.0;
+		} else if (strcmp(arg, "-R") == 0 && arg_idx + 1 < argc) {
+			char *engine_name = argv[++arg_idx];
+			options.requeue = true;
+			if (strcmp(engine_name, "collisions") == 0) {
+				options.requeue_engine = SUDOKU_ENGINE_COLLISIONS;
+			} else if (strcmp(engine_name, "bitmask") == 0) {
+				options.requeue_engine = SUDOKU_ENGINE_BITMASK;
+			} else if (strcmp(engine_name, "dlx") == 0) {
+				options.requeue_engine = SUDOKU_ENGINE_DLX;
+			} else {
+				fprintf(stderr, "unknown engine '%s'\n", engine_name);
+				print_usage();
+				exit(1);
+			}
+		} else if (strcmp(arg, "-j") == 0 && arg_idx + 1 < argc) {
+			int n = atoi(argv[++arg_idx]);
+			if (n < 1) {
+				fprintf(stderr, "-j needs at least 1 thread\n");
+				exit(1);
+			}
+			n_threads = (u32) n;
+		} else if (strcmp(arg, "-s") == 0 && arg_idx + 1 < argc) {
+			stats_filename = argv[++arg_idx];
+		} else if (strcmp(arg, "-C") == 0 && arg_idx + 1 < argc) {
+			int n = atoi(argv[++arg_idx]);
+			if (n < 1) {
+				fprintf(stderr, "-C needs room for at least 1 entry\n");
+				exit(1);
+			}
+			cache_entries = (u32) n;
+		} else if (strcmp(arg, "-P") == 0 && arg_idx + 1 < argc) {
+			cache_filename = argv[++arg_idx];
+		} else if (strcmp(arg, "-x") == 0 && arg_idx + 1 < argc) {
+			convert_filename = argv[++arg_idx];
+		} else if (strcmp(arg, "-F") == 0 && arg_idx + 1 < argc) {
+			first_puzzle = strtoull(argv[++arg_idx], NULL, 10);
+			if (first_puzzle == 0) {
+				fprintf(stderr, "-F counts puzzles from 1\n");
+				exit(1);
+			}
+		} else if (strcmp(arg, "-N") == 0 && arg_idx + 1 < argc) {
+			max_puzzles = strtoull(argv[++arg_idx], NULL, 10);
+		} else if (strcmp(arg, "-S") == 0) {
+			serve = true;
+		} else if (strcmp(arg, "-b") == 0) {
+			benchmark = true;
+		} else if (strcmp(arg, "-w") == 0 && arg_idx + 1 < argc) {
+			bench_warmup = (u32) atoi(argv[++arg_idx]);
+		} else if (strcmp(arg, "-r") == 0 && arg_idx + 1 < argc) {
+			bench_reps = (u32) atoi(argv[++arg_idx]);
+		} else if (strcmp(arg, "-o") == 0 && arg_idx + 1 < argc) {
+			baseline_out = argv[++arg_idx];
+		} else if (strcmp(arg, "-c") == 0 && arg_idx + 1 < argc) {
+			baseline_in = argv[++arg_idx];
+		} else if (strcmp(arg, "-t") == 0 && arg_idx + 1 < argc) {
+			bench_tolerance = atof(argv[++arg_idx]);
+		} else if (arg[0] == '-' && arg[1] != 0) {
+			print_usage();
+			exit(1);
+		} else {
+			file_names[n_files++] = arg;
 		}
-	
-		// skip all whitespace
-		while (isspace(*next_char))
-			next_char++;
 	}
 
-	return line_num;
-}
+	if (n_files == 1)
+		filename = file_names[0];
 
-static char error_str_buf[4096];
+	if (select_simd_kernels(kernel) != kernel && kernel != KERNEL_AUTO) {
+		fprintf(stderr, "the requested kernel is not supported on this cpu\n");
+		exit(1);
+	}
 
-char *make_error_str(const struct is_solved_result solved) {
-	char *to_print_to = error_str_buf;
+	if (benchmark && n_files > 0) {
+		if (grid_side != 0) {
+			fprintf(stderr, "-b does not support -g\n");
+			exit(1);
+		}
 
-	to_print_to += sprintf(to_print_to, "INCORRECT SOLUTION!!!\n");
-		
-	switch (solved.err_type) {
-		case ROW_ERROR: {
-			sprintf(to_print_to, "row %"PRIu32" has value %"PRIu32" multiple times", solved.err_idx, solved.err_value);
+		if ((options.iterative || options.propagation != SUDOKU_PROPAGATE_NONE) && options.engine != SUDOKU_ENGINE_BITMASK) {
+			fprintf(stderr, "-i and -p are only supported by the bitmask engine\n");
+			exit(1);
 		}
-		break;
-		
-		case COL_ERROR: {
-			sprintf(to_print_to, "col %"PRIu32" has value %"PRIu32" multiple times", solved.err_idx, solved.err_value);
+
+		if (options.mrv && options.engine == SUDOKU_ENGINE_DLX) {
+			fprintf(stderr, "-m is not supported by the dlx engine\n");
+			exit(1);
 		}
-		break;
-		
-		case BOX_ERROR: {
-			sprintf(to_print_to, "box %"PRIu32" has value %"PRIu32" multiple times", solved.err_idx, solved.err_value);
+
+		if ((options.value_order != SUDOKU_VALUE_ORDER_ASCENDING || options.restarts != SUDOKU_RESTART_NONE) && options.engine != SUDOKU_ENGINE_COLLISIONS) {
+			fprintf(stderr, "-V and -Z are only supported by the collisions engine\n");
+			exit(1);
 		}
-		break;
 
-		case NOT_FILLED_ERROR: {
-			sprintf(to_print_to, "grid is not even fully filled out");
+		if (options.restarts != SUDOKU_RESTART_NONE && !options.mrv && options.value_order != SUDOKU_VALUE_ORDER_RANDOM && !options.backjump) {
+			fprintf(stderr, "-Z needs -m, -V random or -B, otherwise every restart repeats the same search\n");
+			exit(1);
 		}
-		break;
+
+		if (options.backjump && options.engine != SUDOKU_ENGINE_COLLISIONS) {
+			fprintf(stderr, "-B is only supported by the collisions engine\n");
+			exit(1);
+		}
+
+		if (options.techniques && options.engine == SUDOKU_ENGINE_DLX) {
+			fprintf(stderr, "-X is not supported by the dlx engine\n");
+			exit(1);
+		}
+
+		if (options.count_solutions && (options.engine == SUDOKU_ENGINE_COLLISIONS || options.iterative)) {
+			fprintf(stderr, "-n and -u need the bitmask or dlx engine and cannot be combined with -i\n");
+			exit(1);
+		}
+
+		int exit_code = run_benchmark(&options, file_names, n_files, bench_warmup, bench_reps, baseline_out, baseline_in, bench_tolerance);
+		free(file_names);
+		return exit_code;
 	}
 
-	return error_str_buf;
-}
+	free(file_names);
 
+	if (n_files > 1) {
+		print_usage();
+		exit(1);
+	}
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    if (filename == NULL) {
         fprintf(stderr, "please provide a file name that contains the sudoku\n");
+        print_usage();
         exit(1);
     }
-    
-    char *filename = argv[1];
-	size_t filename_len = strlen(filename);
 
-	clock_t start, end;
+	if (convert_filename) {
+		u64 n_converted = convert_collection(filename, convert_filename, first_puzzle - 1, max_puzzles);
+		printf("wrote %"PRIu64" puzzles to %s\n", n_converted, convert_filename);
+		return EXIT_SUCCESS;
+	}
+
+	u32 file_side = large_grid_side(filename);
+	if (file_side != 0 && file_side != grid_side) {
+		fprintf(stderr, "%s holds %"PRIu32"x%"PRIu32" puzzles, solve it with -g %"PRIu32"\n", filename, file_side, file_side, file_side);
+		exit(1);
+	}
+
+	if (grid_side != 0) {
+		// the engine of grid_n.h solves a file on the calling thread only
+		if (options.iterative || options.backjump || options.value_order != SUDOKU_VALUE_ORDER_ASCENDING || options.restarts != SUDOKU_RESTART_NONE ||
+		    options.propagation != SUDOKU_PROPAGATE_NONE || options.techniques || options.lockstep || options.tiered || stats_filename ||
+		    serve || cache_entries || cache_filename || options.node_budget || options.time_budget_seconds > 0 || options.requeue ||
+		    n_threads > 1) {
+			fprintf(stderr, "-g cannot be combined with -i, -B, -V, -Z, -p, -X, -l, -T, -s, -S, -C, -P, -L, -D, -R or -j\n");
+			exit(1);
+		}
+
+		struct sudoku_solve_stats stats = {0};
+		double solve_duration;
+		u64 n_grids;
+
+		switch (grid_side) {
+			case 9: n_grids = solve_grid_file_9(&options, filename, &stats, &solve_duration); break;
+			case 16: n_grids = solve_grid_file_16(&options, filename, &stats, &solve_duration); break;
+			default: n_grids = solve_grid_file_25(&options, filename, &stats, &solve_duration); break;
+		}
+
+		printf("read %"PRIu64" grids\n", n_grids);
+		printf("%f puzzles/sec\n", n_grids / solve_duration);
+#if defined(SUDOKU_STATS)
+		print_stats_summary(&stats, n_grids);
+#else
+		printf("search nodes: %"PRIu64"\n", stats.nodes);
+#endif
+		printf("that took %f seconds\n", solve_duration);
+
+		return EXIT_SUCCESS;
+	}
+
+	if ((options.iterative || options.propagation != SUDOKU_PROPAGATE_NONE) && options.engine != SUDOKU_ENGINE_BITMASK) {
+		fprintf(stderr, "-i and -p are only supported by the bitmask engine\n");
+		exit(1);
+	}
+
+	if (options.mrv && options.engine == SUDOKU_ENGINE_DLX) {
+		fprintf(stderr, "-m is not supported by the dlx engine\n");
+		exit(1);
+	}
+
+	if ((options.value_order != SUDOKU_VALUE_ORDER_ASCENDING || options.restarts != SUDOKU_RESTART_NONE) && options.engine != SUDOKU_ENGINE_COLLISIONS) {
+		fprintf(stderr, "-V and -Z are only supported by the collisions engine\n");
+		exit(1);
+	}
+
+	if (options.restarts != SUDOKU_RESTART_NONE && !options.mrv && options.value_order != SUDOKU_VALUE_ORDER_RANDOM && !options.backjump) {
+		fprintf(stderr, "-Z needs -m, -V random or -B, otherwise every restart repeats the same search\n");
+		exit(1);
+	}
+
+	if (options.backjump && options.engine != SUDOKU_ENGINE_COLLISIONS) {
+		fprintf(stderr, "-B is only supported by the collisions engine\n");
+		exit(1);
+	}
+
+	if (options.techniques && options.engine == SUDOKU_ENGINE_DLX) {
+		fprintf(stderr, "-X is not supported by the dlx engine\n");
+		exit(1);
+	}
+
+	if (options.count_solutions && options.engine == SUDOKU_ENGINE_COLLISIONS) {
+		fprintf(stderr, "-n and -u are only supported by the bitmask and dlx engines\n");
+		exit(1);
+	}
+
+	if (options.count_solutions && options.iterative) {
+		fprintf(stderr, "-n and -u cannot be combined with -i\n");
+		exit(1);
+	}
+
+	if (options.iterative && options.propagation != SUDOKU_PROPAGATE_NONE) {
+		fprintf(stderr, "-p searches on copies of the state and cannot be combined with -i\n");
+		exit(1);
+	}
+
+	if (options.requeue && options.node_budget == 0 && options.time_budget_seconds <= 0) {
+		fprintf(stderr, "-R needs a budget to run out of, set with -L or -D\n");
+		exit(1);
+	}
+
+	bool split = n_threads > 1 && !serve && strcmp(filename, "-") != 0 && !has_extension(filename, ".sdm") && !has_extension(filename, ".sdb");
+	if (split && (options.engine != SUDOKU_ENGINE_BITMASK || options.iterative || options.requeue)) {
+		fprintf(stderr, "-j on a single puzzle needs the bitmask engine and cannot be combined with -i or -R\n");
+		exit(1);
+	}
+
+	if (options.requeue && options.count_solutions && options.requeue_engine == SUDOKU_ENGINE_COLLISIONS) {
+		fprintf(stderr, "-n and -u cannot requeue to the collisions engine\n");
+		exit(1);
+	}
+
+	struct solution_cache *cache = NULL;
+	if (cache_entries || cache_filename) {
+		cache = malloc(sizeof(*cache));
+		if (!cache) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		solution_cache_init(cache, cache_entries ? cache_entries : SOLUTION_CACHE_DEFAULT_ENTRIES);
+		if (cache_filename)
+			solution_cache_load(cache, cache_filename);
+	}
+
+	if (serve) {
+		if (stats_filename) {
+			fprintf(stderr, "-S does not support -s\n");
+			exit(1);
+		}
+
+		if (strcmp(filename, "-") == 0) {
+			serve_stdin(&options, n_threads, cache);
+		} else {
+#if defined(_WIN32)
+			fprintf(stderr, "-S only serves stdin on windows\n");
+			exit(1);
+#else
+			serve_socket(&options, n_threads, cache, filename);
+#endif
+		}
+
+		if (cache) {
+			if (cache_filename)
+				solution_cache_save(cache, cache_filename);
+			solution_cache_free(cache);
+			free(cache);
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+#if defined(SUDOKU_STATS)
+	struct stats_writer stats_writer;
+	if (stats_filename)
+		stats_writer_open(&stats_writer, stats_filename);
+#else
+	if (stats_filename) {
+		fprintf(stderr, "-s needs the solver to be built with -DSUDOKU_STATS\n");
+		exit(1);
+	}
+#endif
+
+	double start, end;
+	struct sudoku_solve_stats stats = {0};
+	u64 n_puzzles = 1;
 	
-	if (strcmp(&filename[filename_len-4], ".sdm") == 0) {
-		struct grid initial_states[1024];
-		u32 n_grids = load_sdm_collection(filename, initial_states);
-		printf("read %"PRIu32" grids\n", n_grids);
-
-		start = clock();
-		for (u32 grid_idx = 0; grid_idx < n_grids; grid_idx++) {
-			struct grid *to_solve = &initial_states[grid_idx];
-			
-			struct grid solved;
-			solve(to_solve, &solved);
-			
-			struct is_solved_result solved_result = is_solved(&solved);
-			if (!solved_result.is_solved) {
-				char *error_str = make_error_str(solved_result);
-				printf("grid %"PRIu32": %s\n", grid_idx+1, error_str);
+	if (strcmp(filename, "-") == 0 || has_extension(filename, ".sdm") || has_extension(filename, ".sdb")) {
+		// everything is allocated up front and reused for every batch, so memory use is the
+		// same no matter how many puzzles the file has, solving itself allocates nothing
+		struct sdm_reader *reader = malloc(sizeof(*reader));
+		struct sudoku_grid *initial_states = malloc(SDM_BATCH_SIZE * sizeof(initial_states[0]));
+		struct sudoku_grid *solutions = malloc(SDM_BATCH_SIZE * sizeof(solutions[0]));
+		struct is_solved_result *verdicts = malloc(SDM_BATCH_SIZE * sizeof(verdicts[0]));
+		u64 *solution_counts = malloc(SDM_BATCH_SIZE * sizeof(solution_counts[0]));
+		struct sudoku_workspace *workspaces = malloc(n_threads * sizeof(workspaces[0]));
+		if (!reader || !initial_states || !solutions || !verdicts || !solution_counts || !workspaces) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		struct sudoku_solve_stats *puzzle_stats = NULL;
+#if defined(SUDOKU_STATS)
+		if (stats_filename) {
+			puzzle_stats = malloc(SDM_BATCH_SIZE * sizeof(puzzle_stats[0]));
+			if (!puzzle_stats) {
+				fprintf(stderr, "out of memory\n");
 				exit(1);
-			} else {
-				//printf("%"PRIu32": looks good!\n", grid_idx);
 			}
 		}
-		end = clock();
+#endif
+
+		sdm_reader_open(reader, filename);
+		if (!sdm_reader_seek(reader, first_puzzle - 1)) {
+			fprintf(stderr, "the collection has fewer than %"PRIu64" puzzles\n", first_puzzle);
+			exit(1);
+		}
+
+		// only the solving is timed, not the parsing
+		double solve_duration = 0;
+		u64 n_grids = 0;
+
+		u64 n_unsolvable = 0;
+		u64 n_unique = 0;
+		u64 n_multiple = 0;
+		u64 n_timed_out = 0;
+
+		for (;;) {
+			u32 max_batch = SDM_BATCH_SIZE;
+			if (max_puzzles != 0 && max_puzzles - n_grids < max_batch)
+				max_batch = (u32) (max_puzzles - n_grids);
+
+			u32 n_batch = sdm_reader_next_batch(reader, initial_states, max_batch);
+			if (n_batch == 0)
+				break;
+
+			start = monotonic_seconds();
+			solve_batch(&options, initial_states, n_batch, solutions, verdicts, solution_counts, puzzle_stats, cache,
+			            workspaces, n_threads, &stats);
+			end = monotonic_seconds();
+			solve_duration += end - start;
+
+			for (u32 grid_idx = 0; grid_idx < n_batch; grid_idx++) {
+				u64 n_solutions = solution_counts[grid_idx];
+				if (n_solutions == 0) {
+					printf("grid %"PRIu64": has no solution\n", first_puzzle + n_grids + grid_idx);
+					n_unsolvable++;
+					continue;
+				}
+
+				// the batch carries on, the partial state is not worth verifying
+				if (n_solutions == SUDOKU_TIMED_OUT) {
+					printf("grid %"PRIu64": timed out\n", first_puzzle + n_grids + grid_idx);
+					n_timed_out++;
+					continue;
+				}
+
+				if (n_solutions == 1)
+					n_unique++;
+				else
+					n_multiple++;
+
+				if (!verdicts[grid_idx].is_solved) {
+					char error_str[ERROR_STR_SIZE];
+					make_error_str(verdicts[grid_idx], error_str);
+					printf("grid %"PRIu64": "INCORRECT_SOLUTION_BANNER"\n%s\n", first_puzzle + n_grids + grid_idx, error_str);
+					exit(1);
+				}
+			}
+
+#if defined(SUDOKU_STATS)
+			if (puzzle_stats) {
+				for (u32 grid_idx = 0; grid_idx < n_batch; grid_idx++)
+					stats_writer_write(&stats_writer, first_puzzle + n_grids + grid_idx, &puzzle_stats[grid_idx]);
+			}
+#endif
+
+			n_grids += n_batch;
+		}
+
+		sdm_reader_close(reader);
+
+		free(reader);
+		free(initial_states);
+		free(solutions);
+		free(verdicts);
+		free(solution_counts);
+		free(workspaces);
+		free(puzzle_stats);
+
+		printf("read %"PRIu64" grids\n", n_grids);
+		if (options.count_solutions) {
+			printf("%"PRIu64" with a unique solution, %"PRIu64" with more than one, %"PRIu64" with none\n",
+			       n_unique, n_multiple, n_unsolvable);
+		} else if (n_unsolvable > 0) {
+			printf("%"PRIu64" grids have no solution\n", n_unsolvable);
+		}
+		if (n_timed_out > 0)
+			printf("%"PRIu64" grids timed out\n", n_timed_out);
+		printf("%f puzzles/sec\n", n_grids / solve_duration);
+
+		n_puzzles = n_grids;
+
+		start = 0;
+		end = solve_duration;
 
 	} else {
-		struct grid initial_state;
+		struct sudoku_grid initial_state;
+		printf("reading .ss format\n");
 		load_grid_from_file(filename, &initial_state);
 
-		char *grid_str = make_grid_str(&initial_state);
+		char grid_str[GRID_STR_SIZE];
+		make_grid_str(&initial_state, grid_str);
 		printf("initial state: \n%s\n\n", grid_str);
 		
-		struct grid solution;
-		start = clock();
-		solve(&initial_state, &solution);
-		end = clock();
+		struct solve_workspace *workspace = malloc(sizeof(*workspace));
+		if (!workspace) {
+			printf("out of memory\n");
+			exit(1);
+		}
+		
+		struct sudoku_grid solution;
+		start = monotonic_seconds();
+		struct cache_probe probe;
+		u64 n_solutions = cache ? solution_cache_lookup(cache, &options, &initial_state, &solution, &probe) : UINT64_MAX;
+		if (n_solutions == UINT64_MAX) {
+			if (n_threads > 1)
+				n_solutions = solve_split(&options, &initial_state, &solution, n_threads, &stats);
+			else
+				n_solutions = solve_with_options(&options, &initial_state, &solution, workspace, &stats);
+			if (cache)
+				solution_cache_store(cache, &options, &probe, &solution, n_solutions);
+		}
+		end = monotonic_seconds();
+		free(workspace);
 		
-		grid_str = make_grid_str(&solution);
-		printf("final state:\n%s\n\n", grid_str);
+		if (n_solutions == 0) {
+			printf("the grid has no solution\n\n");
+		} else if (n_solutions == SUDOKU_TIMED_OUT) {
+			make_grid_str(&solution, grid_str);
+			printf("the grid timed out, partial state:\n%s\n\n", grid_str);
+		} else {
+			make_grid_str(&solution, grid_str);
+			printf("final state:\n%s\n\n", grid_str);
+		}
+
+		if (options.count_solutions && n_solutions != SUDOKU_TIMED_OUT) {
+			if (options.solution_cap != 0 && n_solutions >= options.solution_cap)
+				printf("solutions: at least %"PRIu64"\n", n_solutions);
+			else
+				printf("solutions: %"PRIu64"\n", n_solutions);
+		}
+
+#if defined(SUDOKU_STATS)
+		if (stats_filename)
+			stats_writer_write(&stats_writer, 1, &stats);
+#endif
+	}
+
+#if defined(SUDOKU_STATS)
+	if (stats_filename)
+		stats_writer_close(&stats_writer);
+
+	print_stats_summary(&stats, n_puzzles);
+#else
+	(void) n_puzzles;
+	printf("search nodes: %"PRIu64"\n", stats.nodes);
+#endif
+
+	if (options.node_budget || options.time_budget_seconds > 0)
+		printf("budget: %"PRIu64" timed out, %"PRIu64" requeued\n", stats.timeouts, stats.requeues);
+
+	if (options.restarts != SUDOKU_RESTART_NONE)
+		printf("restarts: %"PRIu64", at most %"PRIu64" on one puzzle\n", stats.restarts, stats.max_restarts);
+
+	if (options.tiered)
+		printf("tiers: %"PRIu64" finished by singles, %"PRIu64" passed to the engine\n", stats.singles_tier, stats.engine_tier);
+
+	if (cache) {
+		printf("cache: %"PRIu64" hits, %"PRIu64" misses\n", cache->hits, cache->misses);
+		if (cache_filename)
+			solution_cache_save(cache, cache_filename);
+		solution_cache_free(cache);
+		free(cache);
 	}
-  
-	float duration = (float) (end - start) / CLOCKS_PER_SEC;
+
+	double duration = end - start;
     printf("that took %f seconds\n", duration);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+#endif
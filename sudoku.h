@@ -0,0 +1,203 @@
+#pragma once
+
+// the solver as a library, built by `make libsudoku.a libsudoku.so`
+//
+// nothing here allocates or keeps global state besides the kernel selection done on the first call,
+// everything a solve needs lives in the caller's workspace, so any number of threads can solve at
+// once as long as each one uses its own workspace
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define SUDOKU_API
+#else
+#define SUDOKU_API __attribute__((visibility("default")))
+#endif
+
+// 0 is an empty cell
+struct sudoku_grid {
+    uint32_t values[9][9];
+};
+
+typedef enum { SUDOKU_ENGINE_COLLISIONS, SUDOKU_ENGINE_BITMASK, SUDOKU_ENGINE_DLX } sudoku_engine;
+
+// what the search runs after every guess
+typedef enum { SUDOKU_PROPAGATE_NONE, SUDOKU_PROPAGATE_SINGLES, SUDOKU_PROPAGATE_PAIRS } sudoku_propagation;
+
+// the order the collisions engine tries the values of a cell in: ascending, the least constraining
+// first (the value the fewest empty peers could still take), or shuffled
+typedef enum { SUDOKU_VALUE_ORDER_ASCENDING, SUDOKU_VALUE_ORDER_LCV, SUDOKU_VALUE_ORDER_RANDOM } sudoku_value_order;
+
+// when the collisions engine gives up on the current search and starts over
+typedef enum { SUDOKU_RESTART_NONE, SUDOKU_RESTART_LUBY, SUDOKU_RESTART_GEOMETRIC } sudoku_restart_policy;
+
+// logic techniques that can be turned on one by one, as bits of sudoku_solve_options.techniques
+// pointing: a value confined to one row or col of a box goes nowhere else in that row or col
+// box-line: a value confined to one box in a row or col goes nowhere else in that box
+// x-wing and swordfish: a value confined to the same 2 (3) cols in 2 (3) rows goes nowhere else in those cols,
+// and the same with rows and cols swapped
+#define SUDOKU_TECHNIQUE_POINTING  (1u << 0)
+#define SUDOKU_TECHNIQUE_BOX_LINE  (1u << 1)
+#define SUDOKU_TECHNIQUE_X_WING    (1u << 2)
+#define SUDOKU_TECHNIQUE_SWORDFISH (1u << 3)
+#define SUDOKU_N_TECHNIQUES 4
+
+// what each engine supports, an option another engine does not support is ignored by it:
+// - collisions: mrv, techniques, backjump, value_order and restarts, but not count_solutions
+// - bitmask: mrv, iterative, propagation, count_solutions and techniques
+// - dlx: count_solutions
+// tiered, lockstep, the budgets and requeue apply to every engine
+// sudoku_solve and sudoku_solve_batch refuse options outside their enums, more technique bits than
+// there are techniques, and counting with the collisions engine (as the engine or the requeue engine)
+struct sudoku_solve_options {
+    sudoku_engine engine;
+    
+    // collisions and bitmask engines: branch on the empty cell with the fewest candidates instead of going
+    // in row-major order, the collisions engine breaks ties at random from seed
+    bool mrv;
+    
+    // bitmask engine only: use the non-recursive search with an explicit guess stack, unless propagating or counting
+    bool iterative;
+    
+    // bitmask engine only
+    sudoku_propagation propagation;
+    
+    // collisions engine only: when a guess fails, jump straight back to the deepest earlier guess that
+    // caused it instead of the previous one, and remember small sets of guesses that cannot hold together
+    bool backjump;
+    
+    // collisions engine only, the random order (and the mrv ties) are drawn from seed, the same seed
+    // giving the same search
+    sudoku_value_order value_order;
+    uint64_t seed;
+    
+    // collisions engine only: after restart_nodes search nodes times the luby sequence (1 1 2 1 1 2 4 ...),
+    // or times 1.5 more on every restart, the search is started over, with the next random order and mrv
+    // ties and keeping what backjump learned; restarting only changes the search with one of those
+    // 0 nodes means the default of 100
+    sudoku_restart_policy restarts;
+    uint64_t restart_nodes;
+    
+    // bitmask and dlx engines only: count the solutions instead of stopping at the first one, up to
+    // solution_cap of them, a cap of 2 is a uniqueness check, 0 means no cap
+    bool count_solutions;
+    uint64_t solution_cap;
+    
+    // propagate the puzzles of a batch 16 at a time before handing the unfinished ones to the engine
+    bool lockstep;
+    
+    // try lone and hidden singles alone before the engine, which only gets the puzzles they do not finish
+    bool tiered;
+    
+    // the techniques tried, in the order above, once singles (and subsets or naked pairs) find nothing more,
+    // by the collisions and bitmask engines before the search, and by the bitmask engine after every guess
+    // when it propagates
+    uint32_t techniques;
+    
+    // give up on a puzzle after this many search nodes or this much wall time, 0 means no limit
+    // the time is checked every few thousand nodes, so it can be overrun by a fraction of a millisecond
+    uint64_t node_budget;
+    double time_budget_seconds;
+    
+    // a puzzle that runs out of budget is tried once more with requeue_engine, on a budget of its own
+    // with the bitmask engine the retry branches on the most constrained cell and propagates singles
+    bool requeue;
+    sudoku_engine requeue_engine;
+};
+
+// returned instead of a number of solutions by a solve that ran out of budget, the solution is then
+// the partial state (the givens plus what the logic passes placed, or the first solution when counting)
+#define SUDOKU_TIMED_OUT UINT64_MAX
+
+// returned instead of a number of solutions when the options are refused, nothing is solved
+#define SUDOKU_INVALID_OPTIONS (UINT64_MAX - 1)
+
+// counters filled in by the engines
+// the ones from lone_singles on are only counted by a library compiled with -DSUDOKU_STATS, so that a
+// normal build does not pay for them, and are left as they are otherwise; the layout is the same either way
+struct sudoku_solve_stats {
+    // number of values tried by the backtracking search
+    uint64_t nodes;
+    
+    // with tiered set, the puzzles the singles pre-pass finished (solved or found to have no solution)
+    // and the ones it passed on to the engine
+    uint64_t singles_tier;
+    uint64_t engine_tier;
+    
+    // puzzles that ran out of budget and came back timed out, and puzzles retried with the requeue engine
+    uint64_t timeouts;
+    uint64_t requeues;
+    
+    // the times the search was started over, and the most any single puzzle needed
+    uint64_t restarts;
+    uint64_t max_restarts;
+    
+    // cells filled by lone singles and hidden singles, before and during the search
+    uint64_t lone_singles;
+    uint64_t hidden_singles;
+    
+    // candidates removed by naked pairs, by naked triples and quads, and by hidden pairs, triples and quads
+    uint64_t naked_pair_eliminations;
+    uint64_t naked_subset_eliminations;
+    uint64_t hidden_subset_eliminations;
+    
+    // per technique, indexed by the bit number of its SUDOKU_TECHNIQUE_* flag: the passes that eliminated
+    // something, the candidates they eliminated and the wall time spent in every pass, fruitful or not
+    uint64_t technique_hits[SUDOKU_N_TECHNIQUES];
+    uint64_t technique_eliminations[SUDOKU_N_TECHNIQUES];
+    double technique_seconds[SUDOKU_N_TECHNIQUES];
+    
+    uint64_t set_value_calls;
+    uint64_t unset_value_calls;
+    
+    // guesses that were undone
+    uint64_t backtracks;
+    
+    // with backjump set: guesses taken back without trying their other values because the failure below
+    // had nothing to do with them, nogoods stored, and values ruled out by a nogood instead of searched again
+    uint64_t backjumps;
+    uint64_t nogoods_learned;
+    uint64_t nogood_hits;
+    
+    // current and deepest number of guesses on top of each other
+    uint32_t depth;
+    uint32_t max_depth;
+    
+    // wall time spent building the solver state, in the logic passes before the search and in the search
+    double setup_seconds;
+    double logic_seconds;
+    double search_seconds;
+};
+
+// room for the state of any engine, plus the bookkeeping of a batch worker
+// it does not need to be initialized and can be reused for any number of solves, one at a time
+// malloc'ed memory is aligned enough for it
+#define SUDOKU_WORKSPACE_SIZE (64 * 1024)
+
+struct sudoku_workspace {
+    _Alignas(16) unsigned char bytes[SUDOKU_WORKSPACE_SIZE];
+};
+
+// solves puzzle into solution with the engine picked in options
+// returns the number of solutions found, 0 if the puzzle has none, at most 1 unless counting,
+// SUDOKU_TIMED_OUT if it ran out of budget or SUDOKU_INVALID_OPTIONS if the options are refused
+// a puzzle holding anything but 0-9 has no solution, solution is then the puzzle itself
+// stats may be NULL, otherwise they are added to
+SUDOKU_API uint64_t sudoku_solve(const struct sudoku_solve_options *options, const struct sudoku_grid *puzzle, struct sudoku_grid *solution,
+                            struct sudoku_workspace *workspace, struct sudoku_solve_stats *stats);
+
+// solves puzzles[0..n_grids) on n_threads threads, the calling thread being one of them
+// solutions[i] and solution_counts[i] are the result for puzzles[i]
+// a puzzle holding anything but 0-9 has no solution, like in sudoku_solve, its solution is the puzzle itself
+// workspaces is room for n_threads workspaces, stats may be NULL, otherwise they are added to
+// returns false, without solving anything, if the options are refused or n_threads is 0
+SUDOKU_API bool sudoku_solve_batch(const struct sudoku_solve_options *options, const struct sudoku_grid *puzzles, uint32_t n_grids,
+                                   struct sudoku_grid *solutions, uint64_t *solution_counts,
+                                   struct sudoku_workspace *workspaces, uint32_t n_threads, struct sudoku_solve_stats *stats);
+
+// checks that grid is completely and correctly filled in
+// if it is not and error is not NULL, a one line description of the first problem, such as
+// "row 3 has value 7 multiple times", is written to error
+SUDOKU_API bool sudoku_verify(const struct sudoku_grid *grid, char *error, size_t error_size);